@@ -12,9 +12,11 @@
 
 #include <fcntl.h>
 #include <getopt.h>
+#include <inttypes.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <sys/wait.h>
 #include <unistd.h>
 #include <wayland-server-core.h>
@@ -53,7 +55,10 @@
 #endif
 
 #include "idle_inhibit_v1.h"
+#include "ipc.h"
+#include "metrics.h"
 #include "output.h"
+#include "record.h"
 #include "seat.h"
 #include "server.h"
 #include "view.h"
@@ -93,10 +98,14 @@ handle_drm_lease_request(struct wl_listener *listener, void *data)
 }
 #endif
 
+static bool spawn_app(struct cg_app *app);
+static int cleanup_app(struct cg_app *app);
+
 static int
 sigchld_handler(int fd, uint32_t mask, void *data)
 {
-	struct cg_server *server = data;
+	struct cg_app *app = data;
+	struct cg_server *server = app->server;
 
 	/* Close Cage's read pipe. */
 	close(fd);
@@ -107,7 +116,22 @@ sigchld_handler(int fd, uint32_t mask, void *data)
 		wlr_log(WLR_DEBUG, "Connection closed by server");
 	}
 
-	server->return_app_code = true;
+	if (app->restarting) {
+		app->restarting = false;
+		wl_event_source_remove(app->sigchld_source);
+		app->sigchld_source = NULL;
+		int status = cleanup_app(app);
+		wlr_log(WLR_INFO, "Restarting %s, which exited with status %d", app->argv[0], status);
+		app->pid = 0;
+		if (spawn_app(app)) {
+			return 0;
+		}
+		wlr_log(WLR_ERROR, "Unable to restart %s", app->argv[0]);
+	}
+
+	if (!server->exited_app) {
+		server->exited_app = app;
+	}
 	server_terminate(server);
 	return 0;
 }
@@ -152,8 +176,10 @@ create_xcursor_manager(void)
 }
 
 static bool
-spawn_primary_client(struct cg_server *server, char *argv[], pid_t *pid_out, struct wl_event_source **sigchld_source)
+spawn_app(struct cg_app *app)
 {
+	struct cg_server *server = app->server;
+
 	int fd[2];
 	if (pipe(fd) != 0) {
 		wlr_log(WLR_ERROR, "Unable to create pipe");
@@ -167,7 +193,7 @@ spawn_primary_client(struct cg_server *server, char *argv[], pid_t *pid_out, str
 		sigprocmask(SIG_SETMASK, &set, NULL);
 		/* Close read, we only need write in the primary client process. */
 		close(fd[0]);
-		execvp(argv[0], argv);
+		execvp(app->argv[0], app->argv);
 		/* execvp() returns only on failure */
 		wlr_log_errno(WLR_ERROR, "Failed to spawn client");
 		_exit(1);
@@ -177,7 +203,7 @@ spawn_primary_client(struct cg_server *server, char *argv[], pid_t *pid_out, str
 	}
 
 	/* Set this early so that if we fail, the client process will be cleaned up properly. */
-	*pid_out = pid;
+	app->pid = pid;
 
 	if (!set_cloexec(fd[0]) || !set_cloexec(fd[1])) {
 		return false;
@@ -188,18 +214,18 @@ spawn_primary_client(struct cg_server *server, char *argv[], pid_t *pid_out, str
 
 	struct wl_event_loop *event_loop = wl_display_get_event_loop(server->wl_display);
 	uint32_t mask = WL_EVENT_HANGUP | WL_EVENT_ERROR;
-	*sigchld_source = wl_event_loop_add_fd(event_loop, fd[0], mask, sigchld_handler, server);
+	app->sigchld_source = wl_event_loop_add_fd(event_loop, fd[0], mask, sigchld_handler, app);
 
 	wlr_log(WLR_DEBUG, "Child process created with pid %d", pid);
 	return true;
 }
 
 static int
-cleanup_primary_client(pid_t pid)
+cleanup_app(struct cg_app *app)
 {
 	int status;
 
-	waitpid(pid, &status, 0);
+	waitpid(app->pid, &status, 0);
 
 	if (WIFEXITED(status)) {
 		wlr_log(WLR_DEBUG, "Child exited normally with exit status %d", WEXITSTATUS(status));
@@ -213,6 +239,84 @@ cleanup_primary_client(pid_t pid)
 	return 0;
 }
 
+static struct cg_app *
+add_app(struct cg_server *server, char **argv, int argc, bool pinned)
+{
+	struct cg_app *app = calloc(1, sizeof(struct cg_app));
+	if (!app) {
+		return NULL;
+	}
+
+	app->argv = calloc(argc + 1, sizeof(char *));
+	if (!app->argv) {
+		free(app);
+		return NULL;
+	}
+	for (int i = 0; i < argc; i++) {
+		app->argv[i] = argv[i];
+	}
+
+	app->server = server;
+	app->pinned = pinned;
+	wl_list_insert(server->apps.prev, &app->link);
+	return app;
+}
+
+static void
+destroy_app(struct cg_app *app)
+{
+	if (app->sigchld_source) {
+		wl_event_source_remove(app->sigchld_source);
+	}
+	wl_list_remove(&app->link);
+	free(app->argv);
+	free(app);
+}
+
+static pid_t
+get_parent_pid(pid_t pid)
+{
+	char path[64];
+	snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		return -1;
+	}
+
+	char buf[512];
+	size_t len = fread(buf, 1, sizeof(buf) - 1, file);
+	fclose(file);
+	buf[len] = '\0';
+
+	/* The command name may contain spaces and parentheses; the state and
+	 * the parent pid follow its closing parenthesis. */
+	char *end = strrchr(buf, ')');
+	char state;
+	int ppid;
+	if (!end || sscanf(end + 1, " %c %d", &state, &ppid) != 2) {
+		return -1;
+	}
+	return ppid;
+}
+
+struct cg_app *
+server_app_from_pid(struct cg_server *server, pid_t pid)
+{
+	/* Applications often fork helper processes that connect on their
+	 * behalf, so walk up the process tree. */
+	while (pid > 1) {
+		struct cg_app *app;
+		wl_list_for_each (app, &server->apps, link) {
+			if (app->pid == pid) {
+				return app;
+			}
+		}
+		pid = get_parent_pid(pid);
+	}
+	return NULL;
+}
+
 static bool
 drop_permissions(void)
 {
@@ -238,6 +342,54 @@ drop_permissions(void)
 	return true;
 }
 
+/* Terminates the first application and starts it again once it exited,
+ * instead of shutting down. */
+bool
+server_restart_app(struct cg_server *server)
+{
+	if (wl_list_empty(&server->apps)) {
+		return false;
+	}
+
+	struct cg_app *app = wl_container_of(server->apps.next, app, link);
+	if (app->pid <= 0 || app->restarting) {
+		return false;
+	}
+
+	app->restarting = true;
+	if (kill(app->pid, SIGTERM) != 0) {
+		wlr_log_errno(WLR_ERROR, "Unable to terminate %s", app->argv[0]);
+		app->restarting = false;
+		return false;
+	}
+	return true;
+}
+
+void
+server_log_stats(struct cg_server *server)
+{
+	wlr_log(WLR_INFO, "%" PRIu64 " output hotplugs", server->hotplugs);
+	wlr_log(WLR_INFO, "%" PRIu64 " times a view was hidden behind another", server->views_occluded);
+	wlr_log(WLR_INFO, "%" PRIu64 " views destroyed, resident memory %" PRIu64 " KiB", server->views_destroyed,
+		resident_memory_bytes() / 1024);
+	histogram_log(&server->view_map_time, "Views", "map");
+	histogram_log(&server->view_unmap_time, "Views", "unmap");
+	histogram_log(&server->view_destroy_time, "Views", "destroy");
+	histogram_log(&server->popup_create_time, "Popups", "create");
+	histogram_log(&server->decoration_create_time, "Decorations", "create");
+	if (server->coalesce_motion) {
+		wlr_log(WLR_INFO, "%" PRIu64 " pointer motion events coalesced into %" PRIu64 " updates",
+			server->seat->motion_events, server->seat->motion_flushes);
+	}
+
+	seat_log_stats(server->seat);
+
+	struct cg_output *output;
+	wl_list_for_each (output, &server->outputs, link) {
+		output_log_stats(output);
+	}
+}
+
 static int
 handle_signal(int signal, void *data)
 {
@@ -249,23 +401,124 @@ handle_signal(int signal, void *data)
 	case SIGTERM:
 		server_terminate(server);
 		return 0;
+	case SIGUSR1:
+		server_log_stats(server);
+		return 0;
 	default:
 		return 0;
 	}
 }
 
+/* Parses "WxH[@Hz]" into a mode rule. */
+static bool
+parse_mode(const char *str, struct cg_mode_rule *rule)
+{
+	char *end_ptr = NULL;
+	long width = strtol(str, &end_ptr, 10);
+	if (end_ptr == str || *end_ptr != 'x' || width <= 0 || width > INT16_MAX) {
+		return false;
+	}
+	str = end_ptr + 1;
+	long height = strtol(str, &end_ptr, 10);
+	if (end_ptr == str || height <= 0 || height > INT16_MAX) {
+		return false;
+	}
+
+	double refresh = 0;
+	if (*end_ptr == '@') {
+		str = end_ptr + 1;
+		refresh = strtod(str, &end_ptr);
+		if (end_ptr == str || refresh <= 0 || refresh > 1000) {
+			return false;
+		}
+	}
+	if (*end_ptr != '\0') {
+		return false;
+	}
+
+	rule->width = (int32_t) width;
+	rule->height = (int32_t) height;
+	rule->refresh = (int32_t) (refresh * 1000 + 0.5);
+	return true;
+}
+
+static bool
+parse_mode_policy(const char *str, struct cg_mode_rule *rule, bool exact_allowed)
+{
+	rule->spec = str;
+	if (strcmp(str, "preferred") == 0) {
+		rule->policy = CAGE_MODE_POLICY_PREFERRED;
+		return true;
+	} else if (strcmp(str, "refresh") == 0) {
+		rule->policy = CAGE_MODE_POLICY_HIGHEST_REFRESH;
+		return true;
+	} else if (strcmp(str, "power") == 0) {
+		rule->policy = CAGE_MODE_POLICY_LOWEST_POWER;
+		return true;
+	} else if (strncmp(str, "max=", strlen("max=")) == 0) {
+		rule->policy = CAGE_MODE_POLICY_MAX;
+		return parse_mode(str + strlen("max="), rule);
+	} else if (exact_allowed) {
+		rule->policy = CAGE_MODE_POLICY_EXACT;
+		return parse_mode(str, rule);
+	}
+	return false;
+}
+
+/* Parses a -M argument: either a policy for all outputs, or
+ * CONNECTOR=policy for a single one. */
+static bool
+add_mode_rule(struct cg_server *server, const char *str)
+{
+	const char *sep = strchr(str, '=');
+	if (!sep || strncmp(str, "max=", strlen("max=")) == 0) {
+		return parse_mode_policy(str, &server->mode_policy, false);
+	}
+
+	struct cg_mode_rule *rule = calloc(1, sizeof(*rule));
+	if (!rule) {
+		return false;
+	}
+	rule->output_name = malloc(sep - str + 1);
+	if (!rule->output_name || sep == str || !parse_mode_policy(sep + 1, rule, true)) {
+		free(rule->output_name);
+		free(rule);
+		return false;
+	}
+	memcpy(rule->output_name, str, sep - str);
+	rule->output_name[sep - str] = '\0';
+
+	wl_list_insert(server->mode_rules.prev, &rule->link);
+	return true;
+}
+
 static void
 usage(FILE *file, const char *cage)
 {
 	fprintf(file,
 		"Usage: %s [OPTIONS] [--] [APPLICATION...]\n"
 		"\n"
+		" -a cmd\t Run the shell command cmd on an output of its own, may be repeated\n"
+		" -c\t Coalesce pointer motion to once per output refresh\n"
+		" -C\t Accept commands on the IPC socket\n"
 		" -d\t Don't draw client side decorations, when possible\n"
 		" -D\t Enable debug logging\n"
 		" -h\t Display this help message\n"
+		" -H ms\t Wait for outputs to be stable for ms milliseconds after a hotplug\n"
+		" -k file Load the keymap from file, as written by xkbcli compile-keymap\n"
+		" -M policy Select output modes by policy: preferred (default), refresh,\n"
+		"\t power or max=WxH[@Hz]; CONNECTOR=WxH[@Hz] or CONNECTOR=policy\n"
+		"\t applies to a single output. May be given multiple times\n"
 		" -m extend Extend the display across all connected outputs (default)\n"
 		" -m last Use only the last connected output\n"
+		" -m mirror Show the same content on all connected outputs\n"
+		" -O path Serve metrics in the OpenMetrics text format on the Unix socket path\n"
+		" -P file Replay the input events recorded in file once the first view is mapped\n"
+		" -r ms\t Compose ms milliseconds before the next vblank, or 'auto'\n"
+		" -R file Record the input events to file\n"
 		" -s\t Allow VT switching\n"
+		" -S\t Keep the primary application eligible for direct scanout\n"
+		" -t\t Resample touch motion to the output refresh\n"
 		" -v\t Show the version number and exit\n"
 		" -x\t Disable XWayland\n"
 		"\n"
@@ -279,8 +532,23 @@ parse_args(struct cg_server *server, int argc, char *argv[])
 	server->enable_xwayland = true;
 
 	int c;
-	while ((c = getopt(argc, argv, "dDhm:svx")) != -1) {
+	while ((c = getopt(argc, argv, "a:cCdDhH:k:M:m:O:P:r:R:sStvx")) != -1) {
 		switch (c) {
+		case 'a': {
+			char *app_argv[] = {"/bin/sh", "-c", optarg};
+			if (!add_app(server, app_argv, 3, true)) {
+				fprintf(stderr, "Unable to allocate application\n");
+				return false;
+			}
+			server->app_per_output = true;
+			break;
+		}
+		case 'c':
+			server->coalesce_motion = true;
+			break;
+		case 'C':
+			server->enable_ipc = true;
+			break;
 		case 'd':
 			server->xdg_decoration = true;
 			break;
@@ -290,16 +558,65 @@ parse_args(struct cg_server *server, int argc, char *argv[])
 		case 'h':
 			usage(stdout, argv[0]);
 			return false;
+		case 'H': {
+			char *end_ptr = NULL;
+			long value = strtol(optarg, &end_ptr, 10);
+			if (end_ptr == optarg || *end_ptr != '\0' || value < 0 || value > 60000) {
+				fprintf(stderr, "Invalid hotplug debounce time: '%s'\n", optarg);
+				return false;
+			}
+			server->hotplug_debounce = (int) value;
+			break;
+		}
+		case 'k':
+			server->keymap_file = optarg;
+			break;
+		case 'M':
+			if (!add_mode_rule(server, optarg)) {
+				fprintf(stderr, "Invalid mode policy: '%s'\n", optarg);
+				return false;
+			}
+			break;
 		case 'm':
 			if (strcmp(optarg, "last") == 0) {
 				server->output_mode = CAGE_MULTI_OUTPUT_MODE_LAST;
 			} else if (strcmp(optarg, "extend") == 0) {
 				server->output_mode = CAGE_MULTI_OUTPUT_MODE_EXTEND;
+			} else if (strcmp(optarg, "mirror") == 0) {
+				server->output_mode = CAGE_MULTI_OUTPUT_MODE_MIRROR;
 			}
 			break;
+		case 'O':
+			server->metrics_path = optarg;
+			break;
+		case 'P':
+			server->replay_path = optarg;
+			break;
+		case 'r':
+			if (strcmp(optarg, "auto") == 0) {
+				server->auto_render_time = true;
+			} else {
+				char *end_ptr = NULL;
+				long value = strtol(optarg, &end_ptr, 10);
+				if (end_ptr == optarg || *end_ptr != '\0' || value < 0 || value > 1000) {
+					fprintf(stderr, "Invalid render time: '%s'\n", optarg);
+					return false;
+				}
+				server->max_render_time = (int) value;
+			}
+			break;
+		case 'R':
+			server->record_path = optarg;
+			break;
 		case 's':
 			server->allow_vt_switch = true;
 			break;
+		case 'S':
+			server->scanout_mode = true;
+			break;
+		case 't':
+			server->touch_resample = true;
+			break;
 		case 'v':
 			fprintf(stdout, "Cage version " CAGE_VERSION "\n");
 			exit(0);
@@ -312,6 +629,33 @@ parse_args(struct cg_server *server, int argc, char *argv[])
 		}
 	}
 
+	if (optind < argc) {
+		if (server->app_per_output) {
+			fprintf(stderr, "APPLICATION cannot be combined with -a\n");
+			return false;
+		}
+		if (!add_app(server, argv + optind, argc - optind, false)) {
+			fprintf(stderr, "Unable to allocate application\n");
+			return false;
+		}
+	}
+
+	/* Applications are pinned to outputs of an extended layout. */
+	if (server->app_per_output) {
+		server->output_mode = CAGE_MULTI_OUTPUT_MODE_EXTEND;
+	}
+
+	/* Scanout requires the primary view's buffer to cover exactly one
+	 * output, without client-side decorations around it. */
+	if (server->scanout_mode) {
+		server->output_mode = CAGE_MULTI_OUTPUT_MODE_LAST;
+		server->xdg_decoration = true;
+	}
+
+	if (!server->keymap_file) {
+		server->keymap_file = getenv("CAGE_KEYMAP");
+	}
+
 	return true;
 }
 
@@ -319,9 +663,11 @@ int
 main(int argc, char *argv[])
 {
 	struct cg_server server = {.log_level = WLR_INFO};
-	struct wl_event_source *sigchld_source = NULL;
-	pid_t pid = 0;
-	int ret = 0, app_ret = 0;
+	struct cg_app *app, *app_tmp;
+	int ret = 0;
+
+	wl_list_init(&server.apps);
+	wl_list_init(&server.mode_rules);
 
 #ifdef DEBUG
 	server.log_level = WLR_DEBUG;
@@ -352,6 +698,7 @@ main(int argc, char *argv[])
 	struct wl_event_loop *event_loop = wl_display_get_event_loop(server.wl_display);
 	struct wl_event_source *sigint_source = wl_event_loop_add_signal(event_loop, SIGINT, handle_signal, &server);
 	struct wl_event_source *sigterm_source = wl_event_loop_add_signal(event_loop, SIGTERM, handle_signal, &server);
+	struct wl_event_source *sigusr1_source = wl_event_loop_add_signal(event_loop, SIGUSR1, handle_signal, &server);
 
 	server.backend = wlr_backend_autocreate(event_loop, &server.session);
 	if (!server.backend) {
@@ -457,6 +804,15 @@ main(int argc, char *argv[])
 		goto end;
 	}
 
+	if (server.record_path && !record_start(server.seat, server.record_path)) {
+		ret = 1;
+		goto end;
+	}
+	if (server.replay_path && !replay_start(server.seat, server.replay_path)) {
+		ret = 1;
+		goto end;
+	}
+
 	server.idle = wlr_idle_notifier_v1_create(server.wl_display);
 	if (!server.idle) {
 		wlr_log(WLR_ERROR, "Unable to create the idle tracker");
@@ -650,6 +1006,13 @@ main(int argc, char *argv[])
 		wlr_log_errno(WLR_ERROR, "Unable to set WAYLAND_DISPLAY. Clients may not be able to connect");
 	} else {
 		wlr_log(WLR_DEBUG, "Cage " CAGE_VERSION " is running on Wayland display %s", socket);
+		if (server.enable_ipc && !ipc_init(&server)) {
+			wlr_log(WLR_ERROR, "Continuing without IPC");
+		}
+	}
+
+	if (server.metrics_path && !metrics_init(&server, server.metrics_path)) {
+		wlr_log(WLR_ERROR, "Continuing without metrics");
 	}
 
 #if CAGE_HAS_XWAYLAND
@@ -658,9 +1021,11 @@ main(int argc, char *argv[])
 	}
 #endif
 
-	if (optind < argc && !spawn_primary_client(&server, argv + optind, &pid, &sigchld_source)) {
-		ret = 1;
-		goto end;
+	wl_list_for_each (app, &server.apps, link) {
+		if (!spawn_app(app)) {
+			ret = 1;
+			goto end;
+		}
 	}
 
 	seat_center_cursor(server.seat);
@@ -692,15 +1057,31 @@ main(int argc, char *argv[])
 	wl_list_remove(&server.output_layout_change.link);
 
 end:
-	if (pid != 0)
-		app_ret = cleanup_primary_client(pid);
-	if (!ret && server.return_app_code)
-		ret = app_ret;
+	wl_list_for_each_safe (app, app_tmp, &server.apps, link) {
+		if (app->pid != 0) {
+			int app_ret = cleanup_app(app);
+			if (!ret && app == server.exited_app) {
+				ret = app_ret;
+			}
+		}
+		destroy_app(app);
+	}
+	struct cg_mode_rule *rule, *rule_tmp;
+	wl_list_for_each_safe (rule, rule_tmp, &server.mode_rules, link) {
+		wl_list_remove(&rule->link);
+		free(rule->output_name);
+		free(rule);
+	}
 
+	ipc_finish(&server);
+	metrics_finish(&server);
 	wl_event_source_remove(sigint_source);
 	wl_event_source_remove(sigterm_source);
-	if (sigchld_source) {
-		wl_event_source_remove(sigchld_source);
+	wl_event_source_remove(sigusr1_source);
+	if (server.hotplug_timer) {
+		/* Outputs are destroyed along with the display; don't debounce that. */
+		server.hotplug_debounce = 0;
+		wl_event_source_remove(server.hotplug_timer);
 	}
 	seat_destroy(server.seat);
 	/* This function is not null-safe, but we only ever get here
@@ -0,0 +1,454 @@
+/*
+ * Cage: A Wayland kiosk.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include "config.h"
+
+#include <errno.h>
+#include <inttypes.h>
+#include <limits.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/types/wlr_output_layout.h>
+#include <wlr/types/wlr_pointer.h>
+#include <wlr/types/wlr_touch.h>
+#include <wlr/util/log.h>
+
+#include "ipc.h"
+#include "output.h"
+#include "seat.h"
+#include "server.h"
+#include "stats.h"
+#include "unix_socket.h"
+#include "view.h"
+
+/* The protocol is line based. A client sends a command terminated by a
+ * newline; Cage answers with zero or more lines of data, followed by a
+ * line that is either "ok" or "error <reason>". Commands are handled one
+ * at a time per client, in order.
+ *
+ * All buffers are allocated once, when the socket is set up, so handling
+ * a request never allocates. A reply that doesn't fit is cut short and
+ * ends in "error overflow". */
+#define IPC_MAX_CLIENTS 8
+#define IPC_IN_SIZE 256
+#define IPC_OUT_SIZE 16384
+
+struct cg_ipc_client {
+	struct cg_unix_socket_client base;
+	struct cg_ipc *ipc;
+
+	char in[IPC_IN_SIZE];
+	size_t in_len;
+
+	char out[IPC_OUT_SIZE];
+	size_t out_len;
+	size_t out_sent;
+	bool out_overflow;
+};
+
+struct cg_ipc {
+	struct cg_server *server;
+	struct cg_unix_socket socket;
+	struct cg_ipc_client clients[IPC_MAX_CLIENTS];
+};
+
+static void
+reply(struct cg_ipc_client *client, const char *fmt, ...)
+{
+	if (client->out_overflow) {
+		return;
+	}
+
+	size_t space = sizeof(client->out) - client->out_len;
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(client->out + client->out_len, space, fmt, args);
+	va_end(args);
+
+	/* Keep room for the error line. */
+	if (len < 0 || (size_t) len >= space || client->out_len + len > sizeof(client->out) - 32) {
+		client->out_overflow = true;
+		return;
+	}
+	client->out_len += len;
+}
+
+/* Appends a string that may contain anything, such as a window title,
+ * replacing control characters so that it stays on one line. */
+static void
+reply_text(struct cg_ipc_client *client, const char *text)
+{
+	if (client->out_overflow || !text) {
+		return;
+	}
+
+	for (const char *p = text; *p; p++) {
+		if (client->out_len >= sizeof(client->out) - 32) {
+			client->out_overflow = true;
+			return;
+		}
+		client->out[client->out_len++] = (unsigned char) *p < 0x20 ? ' ' : *p;
+	}
+}
+
+static void
+reply_end(struct cg_ipc_client *client, const char *error)
+{
+	if (client->out_overflow) {
+		error = "overflow";
+		client->out_overflow = false;
+	}
+
+	int len;
+	if (error) {
+		len = snprintf(client->out + client->out_len, sizeof(client->out) - client->out_len, "error %s\n",
+			       error);
+	} else {
+		len = snprintf(client->out + client->out_len, sizeof(client->out) - client->out_len, "ok\n");
+	}
+	if (len > 0 && (size_t) len < sizeof(client->out) - client->out_len) {
+		client->out_len += len;
+	}
+}
+
+static void
+command_outputs(struct cg_ipc_client *client, struct cg_server *server)
+{
+	struct cg_output *output;
+	wl_list_for_each_reverse (output, &server->outputs, link) {
+		struct wlr_output *wlr_output = output->wlr_output;
+		struct wlr_box box = {0};
+		wlr_output_layout_get_box(server->output_layout, wlr_output, &box);
+		reply(client, "output %s enabled=%d mode=%dx%d@%d pos=%d,%d scale=%.2f scanout=%s\n", wlr_output->name,
+		      wlr_output->enabled, wlr_output->width, wlr_output->height, wlr_output->refresh, box.x, box.y,
+		      wlr_output->scale, output_scanout_reason_name(output->scanout_reason));
+	}
+}
+
+static void
+command_views(struct cg_ipc_client *client, struct cg_server *server)
+{
+	struct cg_view *view;
+	wl_list_for_each (view, &server->views, link) {
+		int width, height;
+		view->impl->get_geometry(view, &width, &height);
+		reply(client, "view %p pid=%d primary=%d occluded=%d pos=%d,%d size=%dx%d title=", (void *) view,
+		      (int) view->impl->get_pid(view), view_is_primary(view), view->occluded, view->lx, view->ly,
+		      width, height);
+		/* Not view_get_title, which allocates. */
+		reply_text(client, view->impl->get_title(view));
+		reply(client, "\n");
+	}
+}
+
+static void
+command_devices(struct cg_ipc_client *client, struct cg_server *server)
+{
+	struct cg_seat *seat = server->seat;
+
+	struct cg_keyboard_group *group;
+	wl_list_for_each (group, &seat->keyboard_groups, link) {
+		reply(client, "keyboard-group %p virtual=%d\n", (void *) group, group->is_virtual);
+	}
+	struct cg_pointer *pointer;
+	wl_list_for_each (pointer, &seat->pointers, link) {
+		reply(client, "pointer ");
+		reply_text(client, pointer->pointer->base.name);
+		reply(client, "\n");
+	}
+	struct cg_touch *touch;
+	wl_list_for_each (touch, &seat->touch, link) {
+		reply(client, "touch ");
+		reply_text(client, touch->touch->base.name);
+		reply(client, "\n");
+	}
+}
+
+/* Gives a histogram as count/p50/p99/max or, with buckets, as the counts
+ * of its buckets up to the last one that isn't empty. */
+static void
+reply_histogram(struct cg_ipc_client *client, const char *name, const struct cg_histogram *histogram, bool buckets)
+{
+	if (!buckets) {
+		reply(client, " %s=%" PRIu64 "/%" PRIu64 "/%" PRIu64 "/%" PRIu64, name, histogram->count,
+		      histogram_percentile(histogram, 0.5), histogram_percentile(histogram, 0.99),
+		      histogram->max_usec);
+		return;
+	}
+
+	int last = CG_HISTOGRAM_BUCKETS - 1;
+	while (last > 0 && histogram->buckets[last] == 0) {
+		last--;
+	}
+	reply(client, " %s=", name);
+	for (int i = 0; i <= last; i++) {
+		reply(client, i == 0 ? "%" PRIu64 : ",%" PRIu64, histogram->buckets[i]);
+	}
+}
+
+static void
+command_stats(struct cg_ipc_client *client, struct cg_server *server, bool buckets)
+{
+	static const char *input_names[CAGE_INPUT_TYPE_COUNT] = {
+		[CAGE_INPUT_KEYBOARD] = "keyboard",
+		[CAGE_INPUT_POINTER] = "pointer",
+		[CAGE_INPUT_TOUCH] = "touch",
+	};
+
+	reply(client, "server hotplugs=%" PRIu64 " views_occluded=%" PRIu64 " motion_events=%" PRIu64
+		      " motion_updates=%" PRIu64 "\n",
+	      server->hotplugs, server->views_occluded, server->seat->motion_events, server->seat->motion_flushes);
+
+	reply(client, "views mapped=%d destroyed=%" PRIu64, wl_list_length(&server->views), server->views_destroyed);
+	reply_histogram(client, "map", &server->view_map_time, buckets);
+	reply_histogram(client, "unmap", &server->view_unmap_time, buckets);
+	reply_histogram(client, "destroy", &server->view_destroy_time, buckets);
+	reply_histogram(client, "popup", &server->popup_create_time, buckets);
+	reply_histogram(client, "decoration", &server->decoration_create_time, buckets);
+	reply(client, "\n");
+	reply(client, "memory rss=%" PRIu64 "\n", resident_memory_bytes());
+
+	for (int i = 0; i < CAGE_INPUT_TYPE_COUNT; i++) {
+		const struct cg_input_latency *latency = &server->seat->input_latency[i];
+		reply(client, "input %s", input_names[i]);
+		reply_histogram(client, "skew", &latency->skew, buckets);
+		reply_histogram(client, "dispatch", &latency->dispatch, buckets);
+		reply_histogram(client, "flush", &latency->flush, buckets);
+		reply(client, "\n");
+	}
+
+	struct cg_output *output;
+	wl_list_for_each_reverse (output, &server->outputs, link) {
+		reply(client,
+		      "output %s committed=%" PRIu64 " skipped=%" PRIu64 " scanout=%" PRIu64 " composited=%" PRIu64
+		      " mirrored=%" PRIu64 " missed_vblanks=%" PRIu64,
+		      output->wlr_output->name, output->frames_committed, output->frames_skipped,
+		      output->frames_scanout, output->frames_composited, output->frames_mirrored,
+		      output->missed_vblanks);
+		for (int i = CAGE_SCANOUT_OK + 1; i < CAGE_SCANOUT_REASON_COUNT; i++) {
+			reply(client, " rejected_%s=%" PRIu64, output_scanout_reason_name(i),
+			      output->scanout_rejected[i]);
+		}
+		reply_histogram(client, "frame_to_commit", &output->frame_to_commit, buckets);
+		reply_histogram(client, "commit", &output->commit_duration, buckets);
+		reply_histogram(client, "commit_to_present", &output->commit_to_present, buckets);
+		reply(client, "\n");
+	}
+}
+
+static void
+handle_command(struct cg_ipc_client *client, const char *command)
+{
+	struct cg_server *server = client->ipc->server;
+
+	if (strcmp(command, "version") == 0) {
+		reply(client, "version %d cage %s\n", CAGE_IPC_VERSION, CAGE_VERSION);
+	} else if (strcmp(command, "outputs") == 0) {
+		command_outputs(client, server);
+	} else if (strcmp(command, "views") == 0) {
+		command_views(client, server);
+	} else if (strcmp(command, "devices") == 0) {
+		command_devices(client, server);
+	} else if (strcmp(command, "stats") == 0) {
+		command_stats(client, server, false);
+	} else if (strcmp(command, "histograms") == 0) {
+		command_stats(client, server, true);
+	} else if (strcmp(command, "dump-stats") == 0) {
+		server_log_stats(server);
+	} else if (strcmp(command, "reprobe") == 0) {
+		reply(client, "changed %d\n", output_reprobe(server));
+	} else if (strcmp(command, "restart") == 0) {
+		if (!server_restart_app(server)) {
+			reply_end(client, "no application to restart");
+			return;
+		}
+	} else if (strcmp(command, "help") == 0) {
+		reply(client,
+		      "commands version outputs views devices stats histograms dump-stats reprobe restart help\n");
+	} else {
+		reply_end(client, "unknown command");
+		return;
+	}
+
+	reply_end(client, NULL);
+}
+
+/* Returns false if the client was closed. */
+static bool
+client_flush(struct cg_ipc_client *client)
+{
+	while (client->out_sent < client->out_len) {
+		ssize_t len = send(client->base.fd, client->out + client->out_sent, client->out_len - client->out_sent,
+				   MSG_NOSIGNAL);
+		if (len < 0 && errno == EINTR) {
+			continue;
+		} else if (len < 0 && errno == EAGAIN) {
+			wl_event_source_fd_update(client->base.source, WL_EVENT_WRITABLE);
+			return true;
+		} else if (len <= 0) {
+			unix_socket_client_close(&client->base);
+			return false;
+		}
+		client->out_sent += len;
+	}
+
+	client->out_len = 0;
+	client->out_sent = 0;
+	wl_event_source_fd_update(client->base.source, WL_EVENT_READABLE);
+	return true;
+}
+
+/* Handles the complete lines in the input buffer, as long as replies
+ * can be written out. Returns false if the client was closed. */
+static bool
+client_process(struct cg_ipc_client *client)
+{
+	while (client->out_len == 0) {
+		char *newline = memchr(client->in, '\n', client->in_len);
+		if (!newline) {
+			break;
+		}
+		*newline = '\0';
+		if (newline > client->in && newline[-1] == '\r') {
+			newline[-1] = '\0';
+		}
+
+		handle_command(client, client->in);
+
+		size_t consumed = newline - client->in + 1;
+		memmove(client->in, newline + 1, client->in_len - consumed);
+		client->in_len -= consumed;
+
+		if (!client_flush(client)) {
+			return false;
+		}
+	}
+	return true;
+}
+
+static int
+handle_client_event(int fd, uint32_t mask, void *data)
+{
+	struct cg_unix_socket_client *base = data;
+	struct cg_ipc_client *client = wl_container_of(base, client, base);
+
+	if (mask & (WL_EVENT_ERROR | WL_EVENT_HANGUP)) {
+		unix_socket_client_close(base);
+		return 0;
+	}
+
+	if (mask & WL_EVENT_WRITABLE) {
+		if (!client_flush(client) || !client_process(client)) {
+			return 0;
+		}
+	}
+
+	if (mask & WL_EVENT_READABLE) {
+		ssize_t len = read(fd, client->in + client->in_len, sizeof(client->in) - client->in_len);
+		if (len < 0 && (errno == EINTR || errno == EAGAIN)) {
+			return 0;
+		} else if (len <= 0) {
+			unix_socket_client_close(base);
+			return 0;
+		}
+		client->in_len += len;
+
+		if (!client_process(client)) {
+			return 0;
+		}
+		if (client->in_len == sizeof(client->in)) {
+			wlr_log(WLR_DEBUG, "IPC command too long, closing connection");
+			unix_socket_client_close(base);
+		}
+	}
+
+	return 0;
+}
+
+static void
+handle_client_accepted(struct cg_unix_socket_client *base)
+{
+	struct cg_ipc_client *client = wl_container_of(base, client, base);
+	client->in_len = 0;
+	client->out_len = 0;
+	client->out_sent = 0;
+	client->out_overflow = false;
+}
+
+static const struct cg_unix_socket_impl ipc_socket_impl = {
+	.name = "IPC",
+	.max_clients = IPC_MAX_CLIENTS,
+	.client_size = sizeof(struct cg_ipc_client),
+	.handle_client_event = handle_client_event,
+	.client_accepted = handle_client_accepted,
+};
+
+/* Listens on $XDG_RUNTIME_DIR/cage-$WAYLAND_DISPLAY.sock and exports the
+ * path as CAGE_SOCK for the applications. */
+bool
+ipc_init(struct cg_server *server)
+{
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	const char *display = getenv("WAYLAND_DISPLAY");
+	if (!runtime_dir || !display) {
+		return false;
+	}
+
+	char path[PATH_MAX];
+	int len = snprintf(path, sizeof(path), "%s/cage-%s.sock", runtime_dir, display);
+	if (len < 0 || (size_t) len >= sizeof(path)) {
+		wlr_log(WLR_ERROR, "IPC socket path is too long");
+		return false;
+	}
+
+	struct cg_ipc *ipc = calloc(1, sizeof(*ipc));
+	if (!ipc) {
+		wlr_log(WLR_ERROR, "Unable to allocate IPC");
+		return false;
+	}
+	ipc->server = server;
+	for (int i = 0; i < IPC_MAX_CLIENTS; i++) {
+		ipc->clients[i].ipc = ipc;
+	}
+
+	struct wl_event_loop *event_loop = wl_display_get_event_loop(server->wl_display);
+	if (!unix_socket_listen(&ipc->socket, &ipc_socket_impl, ipc->clients, event_loop, path)) {
+		free(ipc);
+		return false;
+	}
+
+	if (setenv("CAGE_SOCK", path, true) < 0) {
+		wlr_log_errno(WLR_ERROR, "Unable to set CAGE_SOCK");
+	}
+	wlr_log(WLR_DEBUG, "IPC listening on %s", path);
+
+	server->ipc = ipc;
+	return true;
+}
+
+void
+ipc_finish(struct cg_server *server)
+{
+	struct cg_ipc *ipc = server->ipc;
+	if (!ipc) {
+		return;
+	}
+
+	unix_socket_finish(&ipc->socket);
+	free(ipc);
+	server->ipc = NULL;
+}
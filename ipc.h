@@ -0,0 +1,13 @@
+#ifndef CG_IPC_H
+#define CG_IPC_H
+
+#include <stdbool.h>
+
+#include "server.h"
+
+#define CAGE_IPC_VERSION 2
+
+bool ipc_init(struct cg_server *server);
+void ipc_finish(struct cg_server *server);
+
+#endif
@@ -0,0 +1,304 @@
+/*
+ * Cage: A Wayland kiosk.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+
+#include "metrics.h"
+#include "output.h"
+#include "seat.h"
+#include "server.h"
+#include "stats.h"
+#include "unix_socket.h"
+#include "view.h"
+
+/* A scrape is answered with the current values in the OpenMetrics text
+ * format. Plain clients get the exposition as soon as they shut down
+ * their side of the connection or send a line; a client that sends an
+ * HTTP request, such as curl --unix-socket, gets an HTTP response once
+ * the request headers are complete.
+ *
+ * Like the IPC socket, all buffers are allocated up front. */
+#define METRICS_MAX_CLIENTS 4
+#define METRICS_IN_SIZE 1024
+#define METRICS_OUT_SIZE 16384
+
+#define METRICS_CONTENT_TYPE "application/openmetrics-text; version=1.0.0; charset=utf-8"
+
+struct cg_metrics_client {
+	struct cg_unix_socket_client base;
+	struct cg_metrics *metrics;
+
+	char in[METRICS_IN_SIZE];
+	size_t in_len;
+
+	char out[METRICS_OUT_SIZE];
+	size_t out_len;
+	size_t out_sent;
+};
+
+struct cg_metrics {
+	struct cg_server *server;
+	struct cg_unix_socket socket;
+	char body[METRICS_OUT_SIZE];
+	struct cg_metrics_client clients[METRICS_MAX_CLIENTS];
+};
+
+struct metrics_buffer {
+	char *data;
+	size_t size;
+	size_t len;
+	bool overflow;
+};
+
+static void
+emit(struct metrics_buffer *buffer, const char *fmt, ...)
+{
+	if (buffer->overflow) {
+		return;
+	}
+
+	va_list args;
+	va_start(args, fmt);
+	int len = vsnprintf(buffer->data + buffer->len, buffer->size - buffer->len, fmt, args);
+	va_end(args);
+
+	if (len < 0 || (size_t) len >= buffer->size - buffer->len) {
+		buffer->overflow = true;
+		return;
+	}
+	buffer->len += len;
+}
+
+static void
+emit_family(struct metrics_buffer *buffer, const char *name, const char *type, const char *help)
+{
+	emit(buffer, "# TYPE %s %s\n# HELP %s %s\n", name, type, name, help);
+}
+
+static void
+metrics_render(struct cg_server *server, struct metrics_buffer *buffer)
+{
+	static const char *input_names[CAGE_INPUT_TYPE_COUNT] = {
+		[CAGE_INPUT_KEYBOARD] = "keyboard",
+		[CAGE_INPUT_POINTER] = "pointer",
+		[CAGE_INPUT_TOUCH] = "touch",
+	};
+	struct cg_output *output;
+
+	emit_family(buffer, "cage_output_frames_committed", "counter", "Frames committed.");
+	wl_list_for_each_reverse (output, &server->outputs, link) {
+		emit(buffer, "cage_output_frames_committed_total{output=\"%s\"} %" PRIu64 "\n",
+		     output->wlr_output->name, output->frames_committed);
+	}
+	emit_family(buffer, "cage_output_frames_skipped", "counter", "Frames skipped for lack of damage.");
+	wl_list_for_each_reverse (output, &server->outputs, link) {
+		emit(buffer, "cage_output_frames_skipped_total{output=\"%s\"} %" PRIu64 "\n", output->wlr_output->name,
+		     output->frames_skipped);
+	}
+	emit_family(buffer, "cage_output_modesets", "counter", "Output mode changes.");
+	wl_list_for_each_reverse (output, &server->outputs, link) {
+		emit(buffer, "cage_output_modesets_total{output=\"%s\"} %" PRIu64 "\n", output->wlr_output->name,
+		     output->modesets);
+	}
+	emit_family(buffer, "cage_output_hotplugs", "counter", "Outputs connected or disconnected.");
+	emit(buffer, "cage_output_hotplugs_total %" PRIu64 "\n", server->hotplugs);
+
+	emit_family(buffer, "cage_input_events", "counter", "Input events handled.");
+	for (int i = 0; i < CAGE_INPUT_TYPE_COUNT; i++) {
+		emit(buffer, "cage_input_events_total{type=\"%s\"} %" PRIu64 "\n", input_names[i],
+		     server->seat->input_latency[i].dispatch.count);
+	}
+	emit_family(buffer, "cage_keymap_compiles", "counter", "Keymaps compiled or loaded.");
+	emit(buffer, "cage_keymap_compiles_total %" PRIu64 "\n", server->seat->keymap_compiles);
+
+	emit_family(buffer, "cage_views_mapped", "gauge", "Mapped views.");
+	emit(buffer, "cage_views_mapped %d\n", wl_list_length(&server->views));
+
+	int clients = 0;
+	struct wl_client *client;
+	wl_client_for_each (client, wl_display_get_client_list(server->wl_display)) {
+		clients++;
+	}
+	emit_family(buffer, "cage_clients_connected", "gauge", "Connected Wayland clients.");
+	emit(buffer, "cage_clients_connected %d\n", clients);
+
+	emit_family(buffer, "process_resident_memory_bytes", "gauge", "Resident memory size in bytes.");
+	emit(buffer, "process_resident_memory_bytes %" PRIu64 "\n", resident_memory_bytes());
+
+	emit(buffer, "# EOF\n");
+}
+
+static void
+client_respond(struct cg_metrics_client *client, bool http)
+{
+	struct cg_metrics *metrics = client->metrics;
+	struct metrics_buffer body = {
+		.data = metrics->body,
+		.size = sizeof(metrics->body),
+	};
+	metrics_render(metrics->server, &body);
+	if (body.overflow) {
+		wlr_log(WLR_ERROR, "Metrics don't fit in %d bytes", METRICS_OUT_SIZE);
+	}
+
+	struct metrics_buffer out = {
+		.data = client->out,
+		.size = sizeof(client->out),
+	};
+	if (http && body.overflow) {
+		emit(&out, "HTTP/1.0 500 Internal Server Error\r\nContent-Length: 0\r\n\r\n");
+	} else if (http) {
+		emit(&out, "HTTP/1.0 200 OK\r\nContent-Type: " METRICS_CONTENT_TYPE "\r\nContent-Length: %zu\r\n\r\n",
+		     body.len);
+	}
+	if (!body.overflow && out.len + body.len <= out.size) {
+		memcpy(out.data + out.len, body.data, body.len);
+		out.len += body.len;
+	}
+
+	client->out_len = out.len;
+	client->out_sent = 0;
+	wl_event_source_fd_update(client->base.source, WL_EVENT_WRITABLE);
+}
+
+/* Whether the HTTP request headers are complete. */
+static bool
+has_blank_line(const char *data, size_t len)
+{
+	for (size_t i = 3; i < len; i++) {
+		if (data[i] == '\n' && data[i - 1] == '\r' && data[i - 2] == '\n' && data[i - 3] == '\r') {
+			return true;
+		}
+	}
+	return false;
+}
+
+static int
+handle_client_event(int fd, uint32_t mask, void *data)
+{
+	struct cg_unix_socket_client *base = data;
+	struct cg_metrics_client *client = wl_container_of(base, client, base);
+
+	if (mask & WL_EVENT_ERROR) {
+		unix_socket_client_close(base);
+		return 0;
+	}
+
+	if (mask & WL_EVENT_WRITABLE) {
+		while (client->out_sent < client->out_len) {
+			ssize_t len = send(fd, client->out + client->out_sent, client->out_len - client->out_sent,
+					   MSG_NOSIGNAL);
+			if (len < 0 && errno == EINTR) {
+				continue;
+			} else if (len < 0 && errno == EAGAIN) {
+				return 0;
+			} else if (len <= 0) {
+				break;
+			}
+			client->out_sent += len;
+		}
+		/* One scrape per connection. */
+		unix_socket_client_close(base);
+		return 0;
+	}
+
+	ssize_t len = 0;
+	if (mask & WL_EVENT_READABLE) {
+		len = read(fd, client->in + client->in_len, sizeof(client->in) - client->in_len);
+		if (len < 0 && (errno == EINTR || errno == EAGAIN)) {
+			return 0;
+		} else if (len < 0) {
+			unix_socket_client_close(base);
+			return 0;
+		}
+		client->in_len += len;
+	}
+
+	bool http = client->in_len >= 4 && memcmp(client->in, "GET ", 4) == 0;
+	bool complete;
+	if (http) {
+		complete = has_blank_line(client->in, client->in_len);
+	} else {
+		complete = memchr(client->in, '\n', client->in_len) != NULL;
+	}
+
+	if (complete || len == 0 || (mask & WL_EVENT_HANGUP)) {
+		client_respond(client, http);
+	} else if (client->in_len == sizeof(client->in)) {
+		wlr_log(WLR_DEBUG, "Metrics request too long, closing connection");
+		unix_socket_client_close(base);
+	}
+	return 0;
+}
+
+static void
+handle_client_accepted(struct cg_unix_socket_client *base)
+{
+	struct cg_metrics_client *client = wl_container_of(base, client, base);
+	client->in_len = 0;
+	client->out_len = 0;
+	client->out_sent = 0;
+}
+
+static const struct cg_unix_socket_impl metrics_socket_impl = {
+	.name = "metrics",
+	.max_clients = METRICS_MAX_CLIENTS,
+	.client_size = sizeof(struct cg_metrics_client),
+	.handle_client_event = handle_client_event,
+	.client_accepted = handle_client_accepted,
+};
+
+bool
+metrics_init(struct cg_server *server, const char *path)
+{
+	struct cg_metrics *metrics = calloc(1, sizeof(*metrics));
+	if (!metrics) {
+		wlr_log(WLR_ERROR, "Unable to allocate metrics");
+		return false;
+	}
+	metrics->server = server;
+	for (int i = 0; i < METRICS_MAX_CLIENTS; i++) {
+		metrics->clients[i].metrics = metrics;
+	}
+
+	struct wl_event_loop *event_loop = wl_display_get_event_loop(server->wl_display);
+	if (!unix_socket_listen(&metrics->socket, &metrics_socket_impl, metrics->clients, event_loop, path)) {
+		free(metrics);
+		return false;
+	}
+
+	wlr_log(WLR_DEBUG, "Serving metrics on %s", path);
+	server->metrics = metrics;
+	return true;
+}
+
+void
+metrics_finish(struct cg_server *server)
+{
+	struct cg_metrics *metrics = server->metrics;
+	if (!metrics) {
+		return;
+	}
+
+	unix_socket_finish(&metrics->socket);
+	free(metrics);
+	server->metrics = NULL;
+}
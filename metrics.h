@@ -0,0 +1,11 @@
+#ifndef CG_METRICS_H
+#define CG_METRICS_H
+
+#include <stdbool.h>
+
+#include "server.h"
+
+bool metrics_init(struct cg_server *server, const char *path);
+void metrics_finish(struct cg_server *server);
+
+#endif
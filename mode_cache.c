@@ -0,0 +1,283 @@
+/*
+ * Cage: A Wayland kiosk.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <math.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <wayland-server-core.h>
+#include <wlr/types/wlr_output.h>
+#include <wlr/util/log.h>
+
+#include "mode_cache.h"
+
+/* The cache holds the state last committed on each connector, one line
+ * per connector:
+ *   <connector> <identity> <width> <height> <refresh> <scale> <transform> <adaptive sync>
+ * where identity is a hash of the make, model and serial reported in the
+ * EDID and of the mode policy, so that a different monitor on the same
+ * connector or a changed policy leads to probing anew. */
+#define CACHE_HEADER "cage-modes 2\n"
+#define CACHE_LINE_MAX 256
+
+struct cache_entry {
+	int32_t width, height, refresh;
+	float scale;
+	int transform;
+	int adaptive_sync;
+};
+
+static char *
+cache_path(bool create)
+{
+	char dir[4096];
+	const char *state_home = getenv("XDG_STATE_HOME");
+	const char *home = getenv("HOME");
+	int len;
+
+	if (state_home && state_home[0] == '/') {
+		len = snprintf(dir, sizeof(dir), "%s/cage", state_home);
+	} else if (home && home[0] == '/') {
+		len = snprintf(dir, sizeof(dir), "%s/.local/state/cage", home);
+	} else {
+		return NULL;
+	}
+	if (len < 0 || (size_t) len >= sizeof(dir)) {
+		return NULL;
+	}
+
+	if (create) {
+		/* Create every missing component, like mkdir -p. */
+		for (char *p = dir + 1; *p; p++) {
+			if (*p != '/') {
+				continue;
+			}
+			*p = '\0';
+			if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+				wlr_log_errno(WLR_DEBUG, "Unable to create %s", dir);
+				return NULL;
+			}
+			*p = '/';
+		}
+		if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+			wlr_log_errno(WLR_DEBUG, "Unable to create %s", dir);
+			return NULL;
+		}
+	}
+
+	size_t size = strlen(dir) + strlen("/modes") + 1;
+	char *path = malloc(size);
+	if (path) {
+		snprintf(path, size, "%s/modes", dir);
+	}
+	return path;
+}
+
+static void
+hash_string(uint64_t *hash, const char *str)
+{
+	/* FNV-1a, including the terminator so that fields don't run together. */
+	const char *p = str ? str : "";
+	do {
+		*hash ^= (unsigned char) *p;
+		*hash *= 0x100000001b3;
+	} while (*p++);
+}
+
+static uint64_t
+output_identity(struct wlr_output *wlr_output, const char *policy)
+{
+	uint64_t hash = 0xcbf29ce484222325;
+	hash_string(&hash, wlr_output->make);
+	hash_string(&hash, wlr_output->model);
+	hash_string(&hash, wlr_output->serial);
+	hash_string(&hash, policy);
+	return hash;
+}
+
+static bool
+parse_line(const char *line, char *name, size_t name_size, uint64_t *identity, struct cache_entry *entry)
+{
+	const char *sep = strchr(line, ' ');
+	if (!sep || (size_t) (sep - line) >= name_size) {
+		return false;
+	}
+	memcpy(name, line, sep - line);
+	name[sep - line] = '\0';
+
+	return sscanf(sep + 1, "%" SCNx64 " %" SCNd32 " %" SCNd32 " %" SCNd32 " %f %d %d", identity, &entry->width,
+		      &entry->height, &entry->refresh, &entry->scale, &entry->transform, &entry->adaptive_sync) == 7;
+}
+
+static bool
+entry_equal(const struct cache_entry *a, const struct cache_entry *b)
+{
+	/* The scale is written with six decimals. */
+	return a->width == b->width && a->height == b->height && a->refresh == b->refresh &&
+	       fabsf(a->scale - b->scale) < 1e-5f && a->transform == b->transform &&
+	       a->adaptive_sync == b->adaptive_sync;
+}
+
+/* Finds the entry of the output as it is connected now. */
+static bool
+cache_find(struct wlr_output *wlr_output, const char *policy, struct cache_entry *entry)
+{
+	char *path = cache_path(false);
+	if (!path) {
+		return false;
+	}
+	FILE *file = fopen(path, "r");
+	free(path);
+	if (!file) {
+		return false;
+	}
+
+	uint64_t identity = output_identity(wlr_output, policy);
+	bool found = false;
+	char line[CACHE_LINE_MAX];
+
+	if (!fgets(line, sizeof(line), file) || strcmp(line, CACHE_HEADER) != 0) {
+		wlr_log(WLR_DEBUG, "Ignoring mode cache with unknown format");
+		goto out;
+	}
+
+	while (fgets(line, sizeof(line), file)) {
+		char name[CACHE_LINE_MAX];
+		uint64_t line_identity;
+		if (parse_line(line, name, sizeof(name), &line_identity, entry) &&
+		    strcmp(name, wlr_output->name) == 0 && line_identity == identity) {
+			found = true;
+			break;
+		}
+	}
+
+out:
+	fclose(file);
+	return found;
+}
+
+/* Adds the cached mode, scale, transform and adaptive sync setting of the
+ * output to state. Returns false if there is no usable entry. */
+bool
+mode_cache_apply(struct wlr_output *wlr_output, const char *policy, struct wlr_output_state *state)
+{
+	if (wl_list_empty(&wlr_output->modes)) {
+		return false;
+	}
+
+	struct cache_entry entry;
+	if (!cache_find(wlr_output, policy, &entry) || entry.scale <= 0 ||
+	    entry.transform < WL_OUTPUT_TRANSFORM_NORMAL || entry.transform > WL_OUTPUT_TRANSFORM_FLIPPED_270) {
+		return false;
+	}
+
+	/* Only modes the output still advertises are used. */
+	struct wlr_output_mode *found = NULL;
+	struct wlr_output_mode *mode;
+	wl_list_for_each (mode, &wlr_output->modes, link) {
+		if (mode->width == entry.width && mode->height == entry.height && mode->refresh == entry.refresh) {
+			found = mode;
+			break;
+		}
+	}
+	if (!found) {
+		return false;
+	}
+
+	wlr_output_state_set_mode(state, found);
+	wlr_output_state_set_scale(state, entry.scale);
+	wlr_output_state_set_transform(state, entry.transform);
+	wlr_output_state_set_adaptive_sync_enabled(state, entry.adaptive_sync);
+	return true;
+}
+
+/* Remembers the state currently committed on the output. */
+void
+mode_cache_store(struct wlr_output *wlr_output, const char *policy)
+{
+	struct wlr_output_mode *mode = wlr_output->current_mode;
+	if (!mode) {
+		return;
+	}
+
+	struct cache_entry current = {
+		.width = mode->width,
+		.height = mode->height,
+		.refresh = mode->refresh,
+		.scale = wlr_output->scale,
+		.transform = wlr_output->transform,
+		.adaptive_sync = wlr_output->adaptive_sync_status == WLR_OUTPUT_ADAPTIVE_SYNC_ENABLED,
+	};
+	struct cache_entry cached;
+	if (cache_find(wlr_output, policy, &cached) && entry_equal(&cached, &current)) {
+		return;
+	}
+
+	char *path = cache_path(true);
+	if (!path) {
+		return;
+	}
+
+	size_t tmp_size = strlen(path) + strlen(".tmp") + 1;
+	char *tmp_path = malloc(tmp_size);
+	if (!tmp_path) {
+		free(path);
+		return;
+	}
+	snprintf(tmp_path, tmp_size, "%s.tmp", path);
+
+	FILE *out = fopen(tmp_path, "w");
+	if (!out) {
+		wlr_log_errno(WLR_DEBUG, "Unable to write mode cache %s", tmp_path);
+		goto out_free;
+	}
+
+	fputs(CACHE_HEADER, out);
+
+	/* Keep the entries of the other connectors. */
+	FILE *in = fopen(path, "r");
+	if (in) {
+		char line[CACHE_LINE_MAX];
+		if (fgets(line, sizeof(line), in) && strcmp(line, CACHE_HEADER) == 0) {
+			while (fgets(line, sizeof(line), in)) {
+				char name[CACHE_LINE_MAX];
+				uint64_t identity;
+				struct cache_entry entry;
+				if (parse_line(line, name, sizeof(name), &identity, &entry) &&
+				    strcmp(name, wlr_output->name) != 0) {
+					fputs(line, out);
+				}
+			}
+		}
+		fclose(in);
+	}
+
+	fprintf(out, "%s %016" PRIx64 " %" PRId32 " %" PRId32 " %" PRId32 " %f %d %d\n", wlr_output->name,
+		output_identity(wlr_output, policy), current.width, current.height, current.refresh, current.scale,
+		current.transform, current.adaptive_sync);
+
+	if (fclose(out) != 0 || rename(tmp_path, path) != 0) {
+		wlr_log_errno(WLR_DEBUG, "Unable to write mode cache %s", path);
+		remove(tmp_path);
+		goto out_free;
+	}
+
+	wlr_log(WLR_DEBUG, "Cached mode %" PRId32 "x%" PRId32 "@%" PRId32 " scale %f transform %d for output %s",
+		current.width, current.height, current.refresh, current.scale, current.transform, wlr_output->name);
+
+out_free:
+	free(tmp_path);
+	free(path);
+}
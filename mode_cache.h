@@ -0,0 +1,10 @@
+#ifndef CG_MODE_CACHE_H
+#define CG_MODE_CACHE_H
+
+#include <stdbool.h>
+#include <wlr/types/wlr_output.h>
+
+bool mode_cache_apply(struct wlr_output *wlr_output, const char *policy, struct wlr_output_state *state);
+void mode_cache_store(struct wlr_output *wlr_output, const char *policy);
+
+#endif
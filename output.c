@@ -12,7 +12,10 @@
 #include "config.h"
 
 #include <assert.h>
+#include <inttypes.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 #include <wayland-server-core.h>
 #include <wlr/backend.h>
@@ -23,6 +26,7 @@
 #endif
 #include <wlr/render/swapchain.h>
 #include <wlr/render/wlr_renderer.h>
+#include <wlr/types/wlr_buffer.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_data_device.h>
 #include <wlr/types/wlr_output.h>
@@ -34,8 +38,12 @@
 #include <wlr/util/log.h>
 #include <wlr/util/region.h>
 
+#include "mode_cache.h"
 #include "output.h"
+#include "seat.h"
 #include "server.h"
+#include "stats.h"
+#include "trace.h"
 #include "view.h"
 #if CAGE_HAS_XWAYLAND
 #include "xwayland.h"
@@ -67,10 +75,147 @@ update_output_manager_config(struct cg_server *server)
 	wlr_output_manager_v1_set_configuration(server->output_manager_v1, config);
 }
 
+static void
+handle_layout_update_idle(void *data)
+{
+	struct cg_server *server = data;
+	server->layout_update_idle = NULL;
+
+	/* Flushed by handle_hotplug_timer once the outputs are stable. */
+	if (server->hotplug_settling) {
+		return;
+	}
+	bool hotplug_flush = server->hotplug_flush;
+	server->hotplug_flush = false;
+
+	if (server->pending_view_position) {
+		server->pending_view_position = false;
+
+		/* Hysteresis: if a burst of hotplugs ended with the layout it
+		 * started from, the views don't need to be reconfigured. Other
+		 * updates, e.g. mode or scale changes, always reposition. */
+		struct wlr_box layout_box;
+		wlr_output_layout_get_box(server->output_layout, NULL, &layout_box);
+		if (hotplug_flush && !server->app_per_output &&
+		    wlr_box_equal(&layout_box, &server->hotplug_layout_box)) {
+			wlr_log(WLR_DEBUG, "Output layout unchanged after hotplug, not repositioning views");
+		} else {
+			view_position_all(server);
+		}
+	}
+	if (server->pending_output_config) {
+		server->pending_output_config = false;
+		update_output_manager_config(server);
+	}
+}
+
+/* A single hotplug emits several output and layout events. Rather than
+ * reconfiguring every view and broadcasting the output configuration for
+ * each of them, mark what is out of date and update it once the current
+ * batch of events has been dispatched. */
+static void
+schedule_layout_update(struct cg_server *server, bool view_position, bool output_config)
+{
+	server->pending_view_position |= view_position;
+	server->pending_output_config |= output_config;
+
+	if (!server->layout_update_idle && !server->hotplug_settling) {
+		struct wl_event_loop *event_loop = wl_display_get_event_loop(server->wl_display);
+		server->layout_update_idle = wl_event_loop_add_idle(event_loop, handle_layout_update_idle, server);
+		if (!server->layout_update_idle) {
+			wlr_log(WLR_ERROR, "Failed to schedule layout update, updating immediately");
+			handle_layout_update_idle(server);
+		}
+	}
+}
+
+static bool
+output_any_enabled(struct cg_server *server)
+{
+	struct cg_output *output;
+	wl_list_for_each (output, &server->outputs, link) {
+		if (output->wlr_output->enabled) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static void output_configure(struct cg_output *output);
+
+static int
+handle_hotplug_timer(void *data)
+{
+	struct cg_server *server = data;
+	server->hotplug_settling = false;
+	server->hotplug_flush = true;
+
+	wlr_log(WLR_DEBUG, "Outputs are stable, applying layout");
+
+	/* In last mode, the most recently connected output that is still
+	 * around wins. */
+	if (server->output_mode == CAGE_MULTI_OUTPUT_MODE_LAST && !wl_list_empty(&server->outputs)) {
+		struct cg_output *last = wl_container_of(server->outputs.next, last, link);
+		if (!last->wlr_output->enabled) {
+			output_configure(last);
+		}
+	}
+
+	schedule_layout_update(server, false, false);
+	return 0;
+}
+
+/* Starts or extends the hotplug debounce window. Returns true if layout
+ * changes are being held back until the outputs are stable. */
+static bool
+server_note_hotplug(struct cg_server *server)
+{
+	server->hotplugs++;
+
+	if (server->hotplug_debounce <= 0) {
+		return false;
+	}
+
+	if (!server->hotplug_timer) {
+		struct wl_event_loop *event_loop = wl_display_get_event_loop(server->wl_display);
+		server->hotplug_timer = wl_event_loop_add_timer(event_loop, handle_hotplug_timer, server);
+		if (!server->hotplug_timer) {
+			wlr_log(WLR_ERROR, "Failed to create hotplug timer, not debouncing hotplugs");
+			return false;
+		}
+	}
+
+	if (!server->hotplug_settling) {
+		wlr_output_layout_get_box(server->output_layout, NULL, &server->hotplug_layout_box);
+		server->hotplug_settling = true;
+	}
+	wl_event_source_timer_update(server->hotplug_timer, server->hotplug_debounce);
+	return true;
+}
+
+static inline void output_layout_add(struct cg_output *output, int32_t x, int32_t y);
+
 static inline void
 output_layout_add_auto(struct cg_output *output)
 {
 	assert(output->scene_output != NULL);
+	/* Mirrored outputs all show the region of the layout covered by the
+	 * mirror source. A mirror with a different aspect ratio is centered
+	 * on it, so the region is letterboxed rather than cropped. */
+	if (output->server->output_mode == CAGE_MULTI_OUTPUT_MODE_MIRROR) {
+		struct cg_output *source = output_mirror_source(output->server);
+		int32_t x = 0, y = 0;
+		if (source && source != output) {
+			int width, height, source_width, source_height;
+			wlr_output_effective_resolution(output->wlr_output, &width, &height);
+			wlr_output_effective_resolution(source->wlr_output, &source_width, &source_height);
+			x = (source_width - width) / 2;
+			y = (source_height - height) / 2;
+		}
+		output_layout_add(output, x, y);
+		return;
+	}
+
 	struct wlr_output_layout_output *layout_output =
 		wlr_output_layout_add_auto(output->server->output_layout, output->wlr_output);
 	wlr_scene_output_layout_add_output(output->server->scene_output_layout, layout_output, output->scene_output);
@@ -112,7 +257,7 @@ output_enable(struct cg_output *output)
 		output_layout_add_auto(output);
 	}
 
-	update_output_manager_config(output->server);
+	schedule_layout_update(output->server, false, true);
 }
 
 static void
@@ -132,19 +277,416 @@ output_disable(struct cg_output *output)
 }
 
 static void
-handle_output_frame(struct wl_listener *listener, void *data)
+output_update_render_time(struct cg_output *output, int64_t render_nsec)
 {
-	struct cg_output *output = wl_container_of(listener, output, frame);
+	/* Track the recent worst case, decaying slowly so that a single
+	 * slow frame doesn't pin the deadline forever. */
+	int64_t decayed = output->render_time_estimate - output->render_time_estimate / 16;
+	output->render_time_estimate = render_nsec > decayed ? render_nsec : decayed;
+
+	/* Round up and keep a millisecond of slack for the commit itself. */
+	int max_render_time = (int) ((output->render_time_estimate + 999999) / 1000000) + 1;
+	int refresh_msec = output->refresh_nsec / 1000000;
+	if (refresh_msec > 0 && max_render_time > refresh_msec) {
+		max_render_time = refresh_msec;
+	}
+	output->max_render_time = max_render_time;
+}
+
+const char *
+output_scanout_reason_name(enum cg_scanout_reason reason)
+{
+	switch (reason) {
+	case CAGE_SCANOUT_OK:
+		return "ok";
+	case CAGE_SCANOUT_NO_VIEW:
+		return "no-view";
+	case CAGE_SCANOUT_DRAG_ICON:
+		return "drag-icon";
+	case CAGE_SCANOUT_DIALOG:
+		return "dialog";
+	case CAGE_SCANOUT_POPUP:
+		return "popup";
+	case CAGE_SCANOUT_NOT_FULLSCREEN:
+		return "not-fullscreen";
+	case CAGE_SCANOUT_SOFTWARE_CURSOR:
+		return "software-cursor";
+	case CAGE_SCANOUT_BACKEND_REJECTED:
+		return "backend-rejected";
+	case CAGE_SCANOUT_REASON_COUNT:
+		break;
+	}
+	return "unknown";
+}
+
+struct scanout_candidate {
+	struct wlr_scene_buffer *buffer;
+	int count;
+};
+
+static void
+scanout_candidate_iterator(struct wlr_scene_buffer *buffer, int sx, int sy, void *data)
+{
+	struct scanout_candidate *candidate = data;
+	candidate->buffer = buffer;
+	candidate->count++;
+}
+
+/* Checks whether the topmost view is in a state where it could be scanned
+ * out on this output. This mirrors the conditions the scene graph applies,
+ * so that we can tell why scanout did not happen. */
+static enum cg_scanout_reason
+output_scanout_check(struct cg_output *output, struct wlr_scene_buffer **buffer_out)
+{
+	struct wlr_output *wlr_output = output->wlr_output;
+
+	struct wlr_output_cursor *cursor;
+	wl_list_for_each (cursor, &wlr_output->cursors, link) {
+		if (cursor->enabled && cursor->visible && cursor != wlr_output->hardware_cursor) {
+			return CAGE_SCANOUT_SOFTWARE_CURSOR;
+		}
+	}
+
+	/* Children of the scene tree are ordered from bottom to top. */
+	struct wlr_scene_node *top = NULL, *node;
+	wl_list_for_each_reverse (node, &output->server->scene->tree.children, link) {
+		if (node->enabled) {
+			top = node;
+			break;
+		}
+	}
+	if (!top) {
+		return CAGE_SCANOUT_NO_VIEW;
+	}
+	if (!top->data) {
+		return CAGE_SCANOUT_DRAG_ICON;
+	}
+
+	struct cg_view *view = top->data;
+	if (!view_is_primary(view)) {
+		return CAGE_SCANOUT_DIALOG;
+	}
+
+	struct scanout_candidate candidate = {0};
+	wlr_scene_node_for_each_buffer(top, scanout_candidate_iterator, &candidate);
+	if (candidate.count == 0) {
+		return CAGE_SCANOUT_NO_VIEW;
+	} else if (candidate.count > 1) {
+		return CAGE_SCANOUT_POPUP;
+	}
+	*buffer_out = candidate.buffer;
+
+	struct wlr_box output_box;
+	wlr_output_layout_get_box(output->server->output_layout, wlr_output, &output_box);
+	int lx, ly;
+	wlr_scene_node_coords(&candidate.buffer->node, &lx, &ly);
+	if (lx != output_box.x || ly != output_box.y || !candidate.buffer->buffer ||
+	    candidate.buffer->buffer->width != wlr_output->width ||
+	    candidate.buffer->buffer->height != wlr_output->height) {
+		return CAGE_SCANOUT_NOT_FULLSCREEN;
+	}
+
+	return CAGE_SCANOUT_OK;
+}
+
+static void
+output_update_scanout(struct cg_output *output, struct wlr_buffer *committed)
+{
+	struct wlr_scene_buffer *candidate = NULL;
+	enum cg_scanout_reason reason = output_scanout_check(output, &candidate);
+
+	/* The scene graph has the last word: if it committed the client's
+	 * buffer, scanout happened regardless of what we predicted. */
+	if (candidate && candidate->buffer == committed) {
+		reason = CAGE_SCANOUT_OK;
+	} else if (reason == CAGE_SCANOUT_OK) {
+		reason = CAGE_SCANOUT_BACKEND_REJECTED;
+	}
+
+	if (reason == CAGE_SCANOUT_OK) {
+		output->frames_scanout++;
+	} else {
+		output->frames_composited++;
+		output->scanout_rejected[reason]++;
+	}
+
+	if (reason != output->scanout_reason) {
+		wlr_log(WLR_DEBUG, "Output %s: direct scanout %s", output->wlr_output->name,
+			reason == CAGE_SCANOUT_OK ? "active" : output_scanout_reason_name(reason));
+		output->scanout_reason = reason;
+	}
+}
+
+/* In mirror mode, the earliest connected output renders the scene and
+ * the other outputs show its frames. */
+struct cg_output *
+output_mirror_source(struct cg_server *server)
+{
+	if (server->output_mode != CAGE_MULTI_OUTPUT_MODE_MIRROR) {
+		return NULL;
+	}
+
+	struct cg_output *output;
+	wl_list_for_each_reverse (output, &server->outputs, link) {
+		if (output->wlr_output->enabled) {
+			return output;
+		}
+	}
+	return NULL;
+}
 
+static void
+output_set_mirror_buffer(struct cg_output *output, struct wlr_buffer *buffer)
+{
+	wlr_buffer_lock(buffer);
+	if (output->mirror_buffer) {
+		wlr_buffer_unlock(output->mirror_buffer);
+	}
+	output->mirror_buffer = buffer;
+	output->mirror_seq = ++output->server->mirror_seq;
+
+	struct cg_output *mirror;
+	wl_list_for_each (mirror, &output->server->outputs, link) {
+		if (mirror != output && mirror->wlr_output->enabled) {
+			wlr_output_schedule_frame(mirror->wlr_output);
+		}
+	}
+}
+
+/* Commits the mirror source's last frame as is. Returns false if that isn't
+ * possible and the output has to render the scene itself. */
+static bool
+output_repaint_mirror(struct cg_output *output, struct cg_output *source)
+{
+	struct wlr_output *wlr_output = output->wlr_output;
+	struct wlr_buffer *buffer = source->mirror_buffer;
+
+	if (!buffer || output->mirror_failed || buffer->width != wlr_output->width ||
+	    buffer->height != wlr_output->height || wlr_output->transform != source->wlr_output->transform) {
+		return false;
+	}
+
+	if (output->mirror_seq == source->mirror_seq) {
+		output->frames_skipped++;
+		return true;
+	}
+
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+	wlr_output_state_set_buffer(&state, buffer);
+	bool ok = wlr_output_commit_state(wlr_output, &state);
+	wlr_output_state_finish(&state);
+
+	if (!ok) {
+		/* E.g. the outputs are driven by different GPUs. */
+		wlr_log(WLR_INFO, "Output %s cannot show frames of %s, rendering it separately", wlr_output->name,
+			source->wlr_output->name);
+		output->mirror_failed = true;
+		return false;
+	}
+
+	output->mirror_seq = source->mirror_seq;
+	output->frames_committed++;
+	output->frames_mirrored++;
+	return true;
+}
+
+static bool
+output_commit(struct cg_output *output)
+{
+	struct wlr_output_state state;
+	wlr_output_state_init(&state);
+
+	CG_TRACE1(scene_commit_begin, output->wlr_output->name);
+	bool ok = wlr_scene_output_build_state(output->scene_output, &state, NULL) &&
+		  wlr_output_commit_state(output->wlr_output, &state);
+	CG_TRACE2(scene_commit_end, output->wlr_output->name, ok);
+	if (ok && (state.committed & WLR_OUTPUT_STATE_BUFFER)) {
+		output_update_scanout(output, state.buffer);
+		if (output_mirror_source(output->server) == output) {
+			output_set_mirror_buffer(output, state.buffer);
+		}
+	}
+
+	wlr_output_state_finish(&state);
+	return ok;
+}
+
+static void
+output_repaint(struct cg_output *output)
+{
 	if (!output->wlr_output->enabled || !output->scene_output) {
 		return;
 	}
 
-	wlr_scene_output_commit(output->scene_output, NULL);
+	CG_TRACE1(repaint_begin, output->wlr_output->name);
+	struct timespec start = {0};
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	struct cg_output *source = output_mirror_source(output->server);
+	bool mirrored = source && source != output && output_repaint_mirror(output, source);
+
+	/* Don't wake up the renderer when nothing changed on this output.
+	 * Frame done events are still sent, because clients may have
+	 * requested a frame callback without submitting any damage. */
+	if (mirrored) {
+		/* Showing the frame of the mirror source. */
+	} else if (!wlr_scene_output_needs_frame(output->scene_output)) {
+		output->frames_skipped++;
+	} else if (output_commit(output)) {
+		output->frames_committed++;
+
+		struct timespec end = {0};
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		int64_t commit_nsec = timespec_to_nsec(&end) - timespec_to_nsec(&start);
+
+		histogram_add(&output->frame_to_commit,
+			      timespec_to_nsec(&start) - timespec_to_nsec(&output->last_frame));
+		histogram_add(&output->commit_duration, commit_nsec);
+		if (output->server->auto_render_time) {
+			output_update_render_time(output, commit_nsec);
+		}
+	}
 
 	struct timespec now = {0};
 	clock_gettime(CLOCK_MONOTONIC, &now);
 	wlr_scene_output_send_frame_done(output->scene_output, &now);
+	CG_TRACE2(repaint_end, output->wlr_output->name, output->frames_committed);
+}
+
+static void
+handle_repaint_idle(void *data)
+{
+	struct cg_output *output = data;
+	output->repaint_idle = NULL;
+	output_repaint(output);
+}
+
+/* Input events that became ready together with the frame or the repaint
+ * timer are dispatched in the same event loop iteration. Compose from an
+ * idle source, which runs after all of them, so that the frame includes
+ * their effects and they don't wait behind a slow composition. */
+static void
+output_schedule_repaint(struct cg_output *output)
+{
+	if (output->repaint_idle) {
+		return;
+	}
+
+	struct wl_event_loop *event_loop = wl_display_get_event_loop(output->server->wl_display);
+	output->repaint_idle = wl_event_loop_add_idle(event_loop, handle_repaint_idle, output);
+	if (!output->repaint_idle) {
+		output_repaint(output);
+	}
+}
+
+static int
+handle_repaint_timer(void *data)
+{
+	struct cg_output *output = data;
+	output_schedule_repaint(output);
+	return 0;
+}
+
+/* Returns the number of milliseconds until the next predicted vblank,
+ * or 0 if there is no usable prediction. */
+static int
+output_msec_until_refresh(struct cg_output *output)
+{
+	if (output->refresh_nsec <= 0 || output->last_presentation.tv_sec == 0) {
+		return 0;
+	}
+
+	struct timespec now = {0};
+	clock_gettime(CLOCK_MONOTONIC, &now);
+
+	int64_t predicted = timespec_to_nsec(&output->last_presentation) + output->refresh_nsec;
+	int64_t nsec_until_refresh = predicted - timespec_to_nsec(&now);
+	if (nsec_until_refresh <= 0) {
+		return 0;
+	}
+	return (int) (nsec_until_refresh / 1000000);
+}
+
+static void
+handle_output_frame(struct wl_listener *listener, void *data)
+{
+	struct cg_output *output = wl_container_of(listener, output, frame);
+
+	if (!output->wlr_output->enabled || !output->scene_output) {
+		return;
+	}
+
+	clock_gettime(CLOCK_MONOTONIC, &output->last_frame);
+	CG_TRACE1(output_frame, output->wlr_output->name);
+
+	if (output->server->touch_resample) {
+		seat_resample_touch(output->server->seat, timespec_to_nsec(&output->last_frame));
+	}
+
+	/* With a render deadline, delay composition until just before the
+	 * predicted vblank so that the frame contains the most recent client
+	 * content and input, instead of content that is a refresh old. */
+	int delay = 0;
+	if (output->max_render_time > 0 && output->repaint_timer) {
+		delay = output_msec_until_refresh(output) - output->max_render_time;
+	}
+
+	if (delay < 1) {
+		output_schedule_repaint(output);
+	} else {
+		wl_event_source_timer_update(output->repaint_timer, delay);
+	}
+}
+
+static void
+handle_output_present(struct wl_listener *listener, void *data)
+{
+	struct cg_output *output = wl_container_of(listener, output, present);
+	struct wlr_output_event_present *event = data;
+
+	if (!event->presented) {
+		return;
+	}
+
+	output->last_presentation = event->when;
+	output->refresh_nsec = event->refresh;
+
+	if (event->commit_seq != output->last_commit_seq) {
+		return;
+	}
+
+	/* Anything presented later than one refresh interval after the
+	 * commit went out missed at least one vblank. */
+	int64_t latency = timespec_to_nsec(&event->when) - timespec_to_nsec(&output->last_commit);
+	histogram_add(&output->commit_to_present, latency);
+	if (event->refresh > 0 && latency > event->refresh) {
+		output->missed_vblanks += latency / event->refresh;
+	}
+}
+
+void
+output_log_stats(struct cg_output *output)
+{
+	const char *name = output->wlr_output->name;
+
+	wlr_log(WLR_INFO,
+		"%s: %" PRIu64 " frames committed, %" PRIu64 " skipped, %" PRIu64 " scanned out, %" PRIu64
+		" mirrored, %" PRIu64 " missed vblanks",
+		name, output->frames_committed, output->frames_skipped, output->frames_scanout, output->frames_mirrored,
+		output->missed_vblanks);
+
+	char rejected[256];
+	int len = 0;
+	for (int i = CAGE_SCANOUT_OK + 1; i < CAGE_SCANOUT_REASON_COUNT && len < (int) sizeof(rejected); i++) {
+		len += snprintf(rejected + len, sizeof(rejected) - len, "%s %s %" PRIu64,
+				i == CAGE_SCANOUT_OK + 1 ? "" : ",", output_scanout_reason_name(i),
+				output->scanout_rejected[i]);
+	}
+	wlr_log(WLR_INFO, "%s: scanout rejected for%s", name, rejected);
+	histogram_log(&output->frame_to_commit, name, "frame to commit");
+	histogram_log(&output->commit_duration, name, "commit duration");
+	histogram_log(&output->commit_to_present, name, "commit to present");
 }
 
 static void
@@ -153,12 +695,22 @@ handle_output_commit(struct wl_listener *listener, void *data)
 	struct cg_output *output = wl_container_of(listener, output, commit);
 	struct wlr_output_event_commit *event = data;
 
+	if (event->state->committed & WLR_OUTPUT_STATE_MODE) {
+		output->modesets++;
+		CG_TRACE4(output_modeset, output->wlr_output->name, output->wlr_output->width,
+			  output->wlr_output->height, output->wlr_output->refresh);
+	}
+	if (event->state->committed & WLR_OUTPUT_STATE_BUFFER) {
+		clock_gettime(CLOCK_MONOTONIC, &output->last_commit);
+		output->last_commit_seq = output->wlr_output->commit_seq;
+	}
+
 	/* Notes:
 	 * - output layout change will also be called if needed to position the views
 	 * - always update output manager configuration even if the output is now disabled */
 
 	if (event->state->committed & OUTPUT_CONFIG_UPDATED) {
-		update_output_manager_config(output->server);
+		schedule_layout_update(output->server, false, true);
 	}
 }
 
@@ -169,7 +721,7 @@ handle_output_request_state(struct wl_listener *listener, void *data)
 	struct wlr_output_event_request_state *event = data;
 
 	if (wlr_output_commit_state(output->wlr_output, event->state)) {
-		update_output_manager_config(output->server);
+		schedule_layout_update(output->server, false, true);
 	}
 }
 
@@ -178,8 +730,7 @@ handle_output_layout_change(struct wl_listener *listener, void *data)
 {
 	struct cg_server *server = wl_container_of(listener, server, output_layout_change);
 
-	view_position_all(server);
-	update_output_manager_config(server);
+	schedule_layout_update(server, true, true);
 }
 
 static bool
@@ -196,33 +747,386 @@ is_nested_output(struct cg_output *output)
 	return false;
 }
 
+/* Gives the first pinned application without an output this output. */
+static void
+output_assign_app(struct cg_output *output)
+{
+	struct cg_app *app;
+	wl_list_for_each (app, &output->server->apps, link) {
+		if (app->output == output) {
+			return;
+		}
+	}
+
+	wl_list_for_each (app, &output->server->apps, link) {
+		if (app->pinned && !app->output) {
+			wlr_log(WLR_DEBUG, "Showing application with pid %d on output %s", app->pid,
+				output->wlr_output->name);
+			app->output = output;
+			return;
+		}
+	}
+}
+
 static void
 output_destroy(struct cg_output *output)
 {
 	struct cg_server *server = output->server;
 	bool was_nested_output = is_nested_output(output);
+	bool settling = server_note_hotplug(server);
 
 	output->wlr_output->data = NULL;
 
+	wlr_log(WLR_DEBUG,
+		"Output %s: %" PRIu64 " frames committed, %" PRIu64 " frames skipped, %" PRIu64 " frames scanned out",
+		output->wlr_output->name, output->frames_committed, output->frames_skipped, output->frames_scanout);
+
 	wl_list_remove(&output->destroy.link);
 	wl_list_remove(&output->commit.link);
 	wl_list_remove(&output->request_state.link);
 	wl_list_remove(&output->frame.link);
+	wl_list_remove(&output->present.link);
 	wl_list_remove(&output->link);
 
+	if (output->repaint_timer) {
+		wl_event_source_remove(output->repaint_timer);
+	}
+	if (output->repaint_idle) {
+		wl_event_source_remove(output->repaint_idle);
+	}
+	if (output->mirror_buffer) {
+		wlr_buffer_unlock(output->mirror_buffer);
+	}
+
 	output_layout_remove(output);
 
+	struct cg_app *app;
+	wl_list_for_each (app, &server->apps, link) {
+		if (app->output == output) {
+			app->output = NULL;
+		}
+	}
+
 	free(output);
 
+	/* Move orphaned applications to outputs that have none. Outputs are
+	 * in reverse connection order. */
+	if (server->app_per_output) {
+		struct cg_output *other;
+		wl_list_for_each_reverse (other, &server->outputs, link) {
+			output_assign_app(other);
+		}
+		schedule_layout_update(server, true, false);
+	}
+
 	if (wl_list_empty(&server->outputs) && was_nested_output) {
 		server_terminate(server);
-	} else if (server->output_mode == CAGE_MULTI_OUTPUT_MODE_LAST && !wl_list_empty(&server->outputs)) {
+	} else if (server->output_mode == CAGE_MULTI_OUTPUT_MODE_LAST && !wl_list_empty(&server->outputs) &&
+		   !settling) {
 		struct cg_output *prev = wl_container_of(server->outputs.next, prev, link);
 		output_enable(prev);
-		view_position_all(server);
+		schedule_layout_update(server, true, false);
+	}
+}
+
+static struct wlr_output_mode *
+output_find_mode(struct wlr_output *wlr_output, int32_t width, int32_t height)
+{
+	struct wlr_output_mode *preferred_mode = wlr_output_preferred_mode(wlr_output);
+	if (preferred_mode && preferred_mode->width == width && preferred_mode->height == height) {
+		return preferred_mode;
+	}
+
+	struct wlr_output_mode *mode;
+	wl_list_for_each (mode, &wlr_output->modes, link) {
+		if (mode->width == width && mode->height == height) {
+			return mode;
+		}
+	}
+	return NULL;
+}
+
+static const struct cg_mode_rule *
+output_mode_rule(struct cg_server *server, struct wlr_output *wlr_output)
+{
+	struct cg_mode_rule *rule;
+	wl_list_for_each (rule, &server->mode_rules, link) {
+		if (strcmp(rule->output_name, wlr_output->name) == 0) {
+			return rule;
+		}
+	}
+	return &server->mode_policy;
+}
+
+static const char *
+mode_rule_spec(const struct cg_mode_rule *rule)
+{
+	return rule->spec ? rule->spec : "preferred";
+}
+
+static bool
+mode_rule_allows(const struct cg_mode_rule *rule, const struct wlr_output_mode *mode)
+{
+	if (rule->policy != CAGE_MODE_POLICY_MAX) {
+		return true;
+	}
+	/* Allow for rounding, e.g. 59.94 Hz when 60 was asked for. */
+	return mode->width <= rule->width && mode->height <= rule->height &&
+	       (rule->refresh == 0 || mode->refresh <= rule->refresh + 500);
+}
+
+/* Returns the mode that the rule picks, without testing it. */
+static struct wlr_output_mode *
+output_policy_mode(struct wlr_output *wlr_output, const struct cg_mode_rule *rule)
+{
+	struct wlr_output_mode *preferred = wlr_output_preferred_mode(wlr_output);
+	struct wlr_output_mode *best = NULL;
+	struct wlr_output_mode *mode;
+
+	switch (rule->policy) {
+	case CAGE_MODE_POLICY_PREFERRED:
+		return preferred;
+	case CAGE_MODE_POLICY_HIGHEST_REFRESH:
+	case CAGE_MODE_POLICY_LOWEST_POWER:
+		if (!preferred) {
+			return NULL;
+		}
+		wl_list_for_each (mode, &wlr_output->modes, link) {
+			if (mode->width != preferred->width || mode->height != preferred->height) {
+				continue;
+			}
+			if (!best || (rule->policy == CAGE_MODE_POLICY_HIGHEST_REFRESH ? mode->refresh > best->refresh
+										   : mode->refresh < best->refresh)) {
+				best = mode;
+			}
+		}
+		return best;
+	case CAGE_MODE_POLICY_MAX:
+		wl_list_for_each (mode, &wlr_output->modes, link) {
+			if (!mode_rule_allows(rule, mode)) {
+				continue;
+			}
+			int64_t area = (int64_t) mode->width * mode->height;
+			int64_t best_area = best ? (int64_t) best->width * best->height : 0;
+			if (!best || area > best_area || (area == best_area && mode->refresh > best->refresh)) {
+				best = mode;
+			}
+		}
+		return best;
+	case CAGE_MODE_POLICY_EXACT:
+		wl_list_for_each (mode, &wlr_output->modes, link) {
+			if (mode->width != rule->width || mode->height != rule->height) {
+				continue;
+			}
+			if (!best || (rule->refresh == 0 && mode->refresh > best->refresh) ||
+			    (rule->refresh != 0 &&
+			     abs(mode->refresh - rule->refresh) < abs(best->refresh - rule->refresh))) {
+				best = mode;
+			}
+		}
+		if (!best) {
+			wlr_log(WLR_ERROR, "Output %s has no mode %s", wlr_output->name, rule->spec);
+		}
+		return best;
+	}
+
+	return NULL;
+}
+
+/* Picks the first mode that passes an atomic test, starting with the mode
+ * of the mirror source, if any, and the mode the policy asks for otherwise.
+ * If neither works, the modes the policy allows are tried in list order,
+ * then all others. */
+static void
+output_pick_mode(struct wlr_output *wlr_output, const struct cg_mode_rule *rule, struct cg_output *source,
+		 struct wlr_output_state *state)
+{
+	/* Outputs without modes, such as headless and nested ones, take any
+	 * size: give them the one an exact rule asks for. */
+	if (wl_list_empty(&wlr_output->modes)) {
+		if (rule->policy == CAGE_MODE_POLICY_EXACT) {
+			wlr_output_state_set_custom_mode(state, rule->width, rule->height, rule->refresh);
+		}
+		return;
+	}
+
+	/* When mirroring, prefer the resolution of the mirror source so
+	 * that its frames can be shown as they are. */
+	struct wlr_output_mode *first_mode = NULL;
+	if (source) {
+		first_mode = output_find_mode(wlr_output, source->wlr_output->width, source->wlr_output->height);
+	}
+	if (!first_mode) {
+		first_mode = output_policy_mode(wlr_output, rule);
+	}
+	if (!first_mode) {
+		first_mode = wlr_output_preferred_mode(wlr_output);
+	}
+	if (first_mode) {
+		wlr_output_state_set_mode(state, first_mode);
+		if (wlr_output_test_state(wlr_output, state)) {
+			return;
+		}
+	}
+
+	for (int pass = 0; pass < 2; pass++) {
+		struct wlr_output_mode *mode;
+		wl_list_for_each (mode, &wlr_output->modes, link) {
+			if (mode == first_mode || mode_rule_allows(rule, mode) != (pass == 0)) {
+				continue;
+			}
+
+			wlr_output_state_set_mode(state, mode);
+			if (wlr_output_test_state(wlr_output, state)) {
+				return;
+			}
+		}
 	}
 }
 
+/* Scales a mirror so that the whole logical area of the mirror source fits
+ * on it, whatever the aspect ratio of its mode. */
+static void
+output_set_mirror_scale(struct wlr_output_state *state, struct cg_output *source)
+{
+	if (!state->mode) {
+		return;
+	}
+
+	int width, height;
+	wlr_output_effective_resolution(source->wlr_output, &width, &height);
+	if (width <= 0 || height <= 0) {
+		return;
+	}
+
+	float scale_x = (float) state->mode->width / (float) width;
+	float scale_y = (float) state->mode->height / (float) height;
+	wlr_output_state_set_scale(state, scale_x < scale_y ? scale_x : scale_y);
+}
+
+/* Picks a mode for a newly connected output and enables it. */
+static void
+output_configure(struct cg_output *output)
+{
+	struct cg_server *server = output->server;
+	struct wlr_output *wlr_output = output->wlr_output;
+
+	struct cg_output *source = output_mirror_source(server);
+	if (source == output) {
+		source = NULL;
+	}
+
+	const struct cg_mode_rule *rule = output_mode_rule(server, wlr_output);
+
+	struct wlr_output_state state = {0};
+	wlr_output_state_set_enabled(&state, true);
+
+	/* The state that was committed on a previous run is committed right
+	 * away, without testing the modes one by one. */
+	bool cached = !source && mode_cache_apply(wlr_output, mode_rule_spec(rule), &state);
+	if (cached) {
+		wlr_log(WLR_DEBUG, "Using cached state for output %s", wlr_output->name);
+	} else {
+		output_pick_mode(wlr_output, rule, source, &state);
+	}
+
+	if (source) {
+		output_set_mirror_scale(&state, source);
+	}
+
+	if (server->output_mode == CAGE_MULTI_OUTPUT_MODE_LAST) {
+		struct cg_output *other;
+		wl_list_for_each (other, &server->outputs, link) {
+			if (other != output) {
+				output_disable(other);
+			}
+		}
+	}
+
+	wlr_log(WLR_DEBUG, "Enabling new output %s", wlr_output->name);
+	bool committed = wlr_output_commit_state(wlr_output, &state);
+	if (!committed && cached) {
+		wlr_log(WLR_INFO, "Cached state for output %s was rejected, probing modes", wlr_output->name);
+		wlr_output_state_finish(&state);
+		state = (struct wlr_output_state){0};
+		wlr_output_state_set_enabled(&state, true);
+		output_pick_mode(wlr_output, rule, NULL, &state);
+		committed = wlr_output_commit_state(wlr_output, &state);
+	}
+	if (committed) {
+		output_layout_add_auto(output);
+		mode_cache_store(wlr_output, mode_rule_spec(rule));
+	}
+	wlr_output_state_finish(&state);
+
+	output_assign_app(output);
+}
+
+static bool
+output_reprobe_one(struct cg_output *output, struct cg_output *source)
+{
+	struct cg_server *server = output->server;
+	struct wlr_output *wlr_output = output->wlr_output;
+	bool changed = false;
+
+	const struct cg_mode_rule *rule = output_mode_rule(server, wlr_output);
+	struct wlr_output_state state = {0};
+	wlr_output_state_set_enabled(&state, true);
+	output_pick_mode(wlr_output, rule, source, &state);
+	if (source) {
+		output_set_mirror_scale(&state, source);
+	}
+
+	bool mode_changed = state.mode && state.mode != wlr_output->current_mode;
+	bool scale_changed = (state.committed & WLR_OUTPUT_STATE_SCALE) && state.scale != wlr_output->scale;
+	if (mode_changed || scale_changed) {
+		wlr_log(WLR_INFO, "Changing mode of output %s to %" PRId32 "x%" PRId32 "@%" PRId32 " scale %.2f",
+			wlr_output->name, state.mode->width, state.mode->height, state.mode->refresh,
+			(state.committed & WLR_OUTPUT_STATE_SCALE) ? state.scale : wlr_output->scale);
+		if (wlr_output_commit_state(wlr_output, &state)) {
+			mode_cache_store(wlr_output, mode_rule_spec(rule));
+			changed = true;
+		}
+	}
+	wlr_output_state_finish(&state);
+
+	return changed;
+}
+
+/* Picks the mode of every enabled output anew, bypassing the mode cache,
+ * and commits it if it differs. Returns the number of changed outputs.
+ *
+ * The mirror source goes first, so that the mirrors pick their modes and
+ * scales against its new resolution. */
+int
+output_reprobe(struct cg_server *server)
+{
+	struct cg_output *source = output_mirror_source(server);
+	int changed = 0;
+
+	if (source && output_reprobe_one(source, NULL)) {
+		changed++;
+	}
+
+	struct cg_output *output;
+	wl_list_for_each (output, &server->outputs, link) {
+		if (output != source && output->wlr_output->enabled && output_reprobe_one(output, source)) {
+			changed++;
+		}
+	}
+
+	/* Recenter the mirrors on the source. */
+	if (source && changed > 0) {
+		wl_list_for_each (output, &server->outputs, link) {
+			if (output->wlr_output->enabled) {
+				output_layout_add_auto(output);
+			}
+		}
+	}
+
+	return changed;
+}
+
 static void
 handle_output_destroy(struct wl_listener *listener, void *data)
 {
@@ -271,6 +1175,17 @@ handle_new_output(struct wl_listener *listener, void *data)
 	wl_signal_add(&wlr_output->events.destroy, &output->destroy);
 	output->frame.notify = handle_output_frame;
 	wl_signal_add(&wlr_output->events.frame, &output->frame);
+	output->present.notify = handle_output_present;
+	wl_signal_add(&wlr_output->events.present, &output->present);
+
+	if (server->max_render_time > 0 || server->auto_render_time) {
+		struct wl_event_loop *event_loop = wl_display_get_event_loop(server->wl_display);
+		output->repaint_timer = wl_event_loop_add_timer(event_loop, handle_repaint_timer, output);
+		if (!output->repaint_timer) {
+			wlr_log(WLR_ERROR, "Failed to create repaint timer, rendering without a deadline");
+		}
+		output->max_render_time = server->max_render_time;
+	}
 
 	output->scene_output = wlr_scene_output_create(server->scene, wlr_output);
 	if (!output->scene_output) {
@@ -278,40 +1193,17 @@ handle_new_output(struct wl_listener *listener, void *data)
 		return;
 	}
 
-	struct wlr_output_state state = {0};
-	wlr_output_state_set_enabled(&state, true);
-	if (!wl_list_empty(&wlr_output->modes)) {
-		struct wlr_output_mode *preferred_mode = wlr_output_preferred_mode(wlr_output);
-		if (preferred_mode) {
-			wlr_output_state_set_mode(&state, preferred_mode);
-		}
-		if (!wlr_output_test_state(wlr_output, &state)) {
-			struct wlr_output_mode *mode;
-			wl_list_for_each (mode, &wlr_output->modes, link) {
-				if (mode == preferred_mode) {
-					continue;
-				}
-
-				wlr_output_state_set_mode(&state, mode);
-				if (wlr_output_test_state(wlr_output, &state)) {
-					break;
-				}
-			}
-		}
-	}
-
-	if (server->output_mode == CAGE_MULTI_OUTPUT_MODE_LAST && wl_list_length(&server->outputs) > 1) {
-		struct cg_output *next = wl_container_of(output->link.next, next, link);
-		output_disable(next);
-	}
-
-	wlr_log(WLR_DEBUG, "Enabling new output %s", wlr_output->name);
-	if (wlr_output_commit_state(wlr_output, &state)) {
-		output_layout_add_auto(output);
+	/* In last mode, a new output replaces the current one. While hotplugs
+	 * are settling, keep the current output until the new one turns out to
+	 * stay, so that a flapping connector doesn't cause modesets. */
+	bool settling = server_note_hotplug(server);
+	if (server->output_mode == CAGE_MULTI_OUTPUT_MODE_LAST && settling && output_any_enabled(server)) {
+		wlr_log(WLR_DEBUG, "Deferring configuration of new output %s", wlr_output->name);
+	} else {
+		output_configure(output);
 	}
 
-	view_position_all(output->server);
-	update_output_manager_config(output->server);
+	schedule_layout_update(server, true, true);
 }
 
 void
@@ -381,6 +1273,9 @@ output_config_apply(struct cg_server *server, struct wlr_output_configuration_v1
 
 		if (head->state.enabled) {
 			output_layout_add(output, head->state.x, head->state.y);
+			/* Keep the mode, scale and transform chosen by the user. */
+			struct wlr_output *wlr_output = output->wlr_output;
+			mode_cache_store(wlr_output, mode_rule_spec(output_mode_rule(server, wlr_output)));
 		} else {
 			output_layout_remove(output);
 		}
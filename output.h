@@ -1,12 +1,27 @@
 #ifndef CG_OUTPUT_H
 #define CG_OUTPUT_H
 
+#include <time.h>
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_output.h>
 
 #include "server.h"
+#include "stats.h"
 #include "view.h"
 
+/* Why a committed frame was composited instead of scanned out directly. */
+enum cg_scanout_reason {
+	CAGE_SCANOUT_OK,
+	CAGE_SCANOUT_NO_VIEW,
+	CAGE_SCANOUT_DRAG_ICON,
+	CAGE_SCANOUT_DIALOG,
+	CAGE_SCANOUT_POPUP,
+	CAGE_SCANOUT_NOT_FULLSCREEN,
+	CAGE_SCANOUT_SOFTWARE_CURSOR,
+	CAGE_SCANOUT_BACKEND_REJECTED,
+	CAGE_SCANOUT_REASON_COUNT,
+};
+
 struct cg_output {
 	struct cg_server *server;
 	struct wlr_output *wlr_output;
@@ -16,6 +31,47 @@ struct cg_output {
 	struct wl_listener request_state;
 	struct wl_listener destroy;
 	struct wl_listener frame;
+	struct wl_listener present;
+
+	/* Render deadline scheduling: composition is delayed until
+	 * max_render_time milliseconds before the predicted vblank. */
+	struct wl_event_source *repaint_timer;
+	struct timespec last_presentation;
+	int refresh_nsec;
+	int max_render_time;
+	int64_t render_time_estimate; // nsec, only used with auto_render_time
+	/* Composition runs after all other ready events, see
+	 * output_schedule_repaint. */
+	struct wl_event_source *repaint_idle;
+
+	/* Frame statistics; a frame is skipped when the scene has no
+	 * pending damage for this output. */
+	uint64_t frames_committed;
+	uint64_t frames_skipped;
+
+	/* Committed frames split by whether the primary view was scanned
+	 * out directly, with per-reason counts for composited frames. */
+	uint64_t frames_scanout;
+	uint64_t frames_composited;
+	enum cg_scanout_reason scanout_reason;
+	uint64_t scanout_rejected[CAGE_SCANOUT_REASON_COUNT];
+
+	/* Mirror mode: the source keeps its last frame so that the other
+	 * outputs can commit it without rendering the scene again. */
+	struct wlr_buffer *mirror_buffer;
+	uint64_t mirror_seq;
+	bool mirror_failed;
+	uint64_t frames_mirrored;
+
+	/* Frame timing, dumped with output_log_stats. */
+	struct timespec last_frame;
+	struct timespec last_commit;
+	uint32_t last_commit_seq;
+	struct cg_histogram frame_to_commit;
+	struct cg_histogram commit_duration;
+	struct cg_histogram commit_to_present;
+	uint64_t missed_vblanks;
+	uint64_t modesets;
 
 	struct wl_list link; // cg_server::outputs
 };
@@ -25,5 +81,9 @@ void handle_output_manager_test(struct wl_listener *listener, void *data);
 void handle_output_layout_change(struct wl_listener *listener, void *data);
 void handle_new_output(struct wl_listener *listener, void *data);
 void output_set_window_title(struct cg_output *output, const char *title);
+const char *output_scanout_reason_name(enum cg_scanout_reason reason);
+struct cg_output *output_mirror_source(struct cg_server *server);
+void output_log_stats(struct cg_output *output);
+int output_reprobe(struct cg_server *server);
 
 #endif
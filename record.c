@@ -0,0 +1,400 @@
+/*
+ * Cage: A Wayland kiosk.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <wayland-server-core.h>
+#include <wlr/interfaces/wlr_keyboard.h>
+#include <wlr/interfaces/wlr_pointer.h>
+#include <wlr/interfaces/wlr_touch.h>
+#include <wlr/util/log.h>
+
+#include "record.h"
+#include "seat.h"
+#include "server.h"
+#include "stats.h"
+
+/* A recording starts with this header, followed by the records. */
+struct cg_record_header {
+	char magic[8];
+	uint32_t version;
+	uint32_t record_size;
+};
+
+#define RECORD_MAGIC "cageinpt"
+#define RECORD_VERSION 1
+
+struct cg_recorder {
+	FILE *file;
+	int64_t start_nsec;
+	uint64_t count;
+};
+
+/* Replayed events are sent through devices of their own, so that they
+ * take the same path through wlr_cursor and the keyboard group as the
+ * recorded ones did. */
+struct cg_replay {
+	struct cg_seat *seat;
+	struct cg_record *records;
+	size_t count;
+	size_t next;
+	int64_t start_nsec; // 0 until replay_begin
+	struct wl_event_source *timer;
+
+	struct wlr_pointer pointer;
+	struct wlr_touch touch;
+	struct wlr_keyboard keyboard;
+
+	/* How long after its due time each event was sent. */
+	struct cg_histogram lateness;
+};
+
+static int64_t
+now_nsec(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return timespec_to_nsec(&now);
+}
+
+bool
+record_start(struct cg_seat *seat, const char *path)
+{
+	struct cg_recorder *recorder = calloc(1, sizeof(*recorder));
+	if (!recorder) {
+		wlr_log(WLR_ERROR, "Unable to allocate input recorder");
+		return false;
+	}
+
+	recorder->file = fopen(path, "w");
+	if (!recorder->file) {
+		wlr_log_errno(WLR_ERROR, "Unable to open %s for recording", path);
+		free(recorder);
+		return false;
+	}
+	/* Records are written out in blocks rather than one by one. */
+	setvbuf(recorder->file, NULL, _IOFBF, 64 * sizeof(struct cg_record));
+
+	struct cg_record_header header = {
+		.version = RECORD_VERSION,
+		.record_size = sizeof(struct cg_record),
+	};
+	memcpy(header.magic, RECORD_MAGIC, sizeof(header.magic));
+	if (fwrite(&header, sizeof(header), 1, recorder->file) != 1) {
+		wlr_log_errno(WLR_ERROR, "Unable to write to %s", path);
+		fclose(recorder->file);
+		free(recorder);
+		return false;
+	}
+
+	recorder->start_nsec = now_nsec();
+	seat->recorder = recorder;
+	wlr_log(WLR_DEBUG, "Recording input events to %s", path);
+	return true;
+}
+
+void
+record_event(struct cg_seat *seat, const struct cg_record *record)
+{
+	struct cg_recorder *recorder = seat->recorder;
+	if (!recorder) {
+		return;
+	}
+
+	struct cg_record copy = *record;
+	copy.nsec = now_nsec() - recorder->start_nsec;
+	if (fwrite(&copy, sizeof(copy), 1, recorder->file) != 1) {
+		wlr_log_errno(WLR_ERROR, "Unable to record input event, stopping the recording");
+		record_finish(seat);
+		return;
+	}
+	recorder->count++;
+}
+
+void
+record_finish(struct cg_seat *seat)
+{
+	struct cg_recorder *recorder = seat->recorder;
+	if (!recorder) {
+		return;
+	}
+
+	if (fclose(recorder->file) != 0) {
+		wlr_log_errno(WLR_ERROR, "Unable to finish the input recording");
+	}
+	wlr_log(WLR_INFO, "Recorded %" PRIu64 " input events", recorder->count);
+	free(recorder);
+	seat->recorder = NULL;
+}
+
+static const struct wlr_pointer_impl replay_pointer_impl = {
+	.name = "cage-replay-pointer",
+};
+
+static const struct wlr_touch_impl replay_touch_impl = {
+	.name = "cage-replay-touch",
+};
+
+static const struct wlr_keyboard_impl replay_keyboard_impl = {
+	.name = "cage-replay-keyboard",
+};
+
+static bool
+replay_load(struct cg_replay *replay, const char *path)
+{
+	FILE *file = fopen(path, "r");
+	if (!file) {
+		wlr_log_errno(WLR_ERROR, "Unable to open recording %s", path);
+		return false;
+	}
+
+	bool ok = false;
+	struct cg_record_header header;
+	if (fread(&header, sizeof(header), 1, file) != 1 ||
+	    memcmp(header.magic, RECORD_MAGIC, sizeof(header.magic)) != 0 || header.version != RECORD_VERSION ||
+	    header.record_size != sizeof(struct cg_record)) {
+		wlr_log(WLR_ERROR, "%s is not an input recording of this version of Cage", path);
+		goto out;
+	}
+
+	/* All records are read up front, so that replaying doesn't wait
+	 * for the disk. */
+	if (fseek(file, 0, SEEK_END) != 0) {
+		wlr_log_errno(WLR_ERROR, "Unable to read recording %s", path);
+		goto out;
+	}
+	long size = ftell(file) - (long) sizeof(header);
+	if (size < 0 || fseek(file, sizeof(header), SEEK_SET) != 0) {
+		wlr_log_errno(WLR_ERROR, "Unable to read recording %s", path);
+		goto out;
+	}
+
+	replay->count = size / sizeof(struct cg_record);
+	replay->records = calloc(replay->count ? replay->count : 1, sizeof(struct cg_record));
+	if (!replay->records) {
+		wlr_log(WLR_ERROR, "Unable to allocate %zu input records", replay->count);
+		goto out;
+	}
+	if (fread(replay->records, sizeof(struct cg_record), replay->count, file) != replay->count) {
+		wlr_log(WLR_ERROR, "Recording %s is truncated", path);
+		goto out;
+	}
+	ok = true;
+
+out:
+	fclose(file);
+	return ok;
+}
+
+static void
+replay_emit(struct cg_replay *replay, const struct cg_record *record, uint32_t time_msec)
+{
+	switch ((enum cg_record_type) record->type) {
+	case CAGE_RECORD_POINTER_MOTION: {
+		struct wlr_pointer_motion_event event = {
+			.pointer = &replay->pointer,
+			.time_msec = time_msec,
+			.delta_x = record->x,
+			.delta_y = record->y,
+			.unaccel_dx = record->ux,
+			.unaccel_dy = record->uy,
+		};
+		wl_signal_emit_mutable(&replay->pointer.events.motion, &event);
+		break;
+	}
+	case CAGE_RECORD_POINTER_MOTION_ABSOLUTE: {
+		struct wlr_pointer_motion_absolute_event event = {
+			.pointer = &replay->pointer,
+			.time_msec = time_msec,
+			.x = record->x,
+			.y = record->y,
+		};
+		wl_signal_emit_mutable(&replay->pointer.events.motion_absolute, &event);
+		break;
+	}
+	case CAGE_RECORD_POINTER_BUTTON: {
+		struct wlr_pointer_button_event event = {
+			.pointer = &replay->pointer,
+			.time_msec = time_msec,
+			.button = record->a,
+			.state = record->b,
+		};
+		wl_signal_emit_mutable(&replay->pointer.events.button, &event);
+		break;
+	}
+	case CAGE_RECORD_POINTER_AXIS: {
+		struct wlr_pointer_axis_event event = {
+			.pointer = &replay->pointer,
+			.time_msec = time_msec,
+			.source = record->a,
+			.orientation = record->b,
+			.relative_direction = record->c,
+			.delta = record->x,
+			.delta_discrete = (int32_t) record->y,
+		};
+		wl_signal_emit_mutable(&replay->pointer.events.axis, &event);
+		break;
+	}
+	case CAGE_RECORD_POINTER_FRAME:
+		wl_signal_emit_mutable(&replay->pointer.events.frame, &replay->pointer);
+		break;
+	case CAGE_RECORD_TOUCH_DOWN: {
+		struct wlr_touch_down_event event = {
+			.touch = &replay->touch,
+			.time_msec = time_msec,
+			.touch_id = record->a,
+			.x = record->x,
+			.y = record->y,
+		};
+		wl_signal_emit_mutable(&replay->touch.events.down, &event);
+		break;
+	}
+	case CAGE_RECORD_TOUCH_UP: {
+		struct wlr_touch_up_event event = {
+			.touch = &replay->touch,
+			.time_msec = time_msec,
+			.touch_id = record->a,
+		};
+		wl_signal_emit_mutable(&replay->touch.events.up, &event);
+		break;
+	}
+	case CAGE_RECORD_TOUCH_MOTION: {
+		struct wlr_touch_motion_event event = {
+			.touch = &replay->touch,
+			.time_msec = time_msec,
+			.touch_id = record->a,
+			.x = record->x,
+			.y = record->y,
+		};
+		wl_signal_emit_mutable(&replay->touch.events.motion, &event);
+		break;
+	}
+	case CAGE_RECORD_TOUCH_FRAME:
+		wl_signal_emit_mutable(&replay->touch.events.frame, NULL);
+		break;
+	case CAGE_RECORD_KEY: {
+		struct wlr_keyboard_key_event event = {
+			.time_msec = time_msec,
+			.keycode = record->a,
+			.update_state = true,
+			.state = record->b,
+		};
+		wlr_keyboard_notify_key(&replay->keyboard, &event);
+		break;
+	}
+	default:
+		wlr_log(WLR_DEBUG, "Skipping input record of unknown type %" PRIu32, record->type);
+		break;
+	}
+}
+
+/* Sends every event that is due, then sleeps until the next one. The
+ * timestamps of the events are those of the replay, so that the input
+ * latency statistics of the seat measure the replay. */
+static int
+handle_replay_timer(void *data)
+{
+	struct cg_replay *replay = data;
+
+	while (replay->next < replay->count) {
+		const struct cg_record *record = &replay->records[replay->next];
+		int64_t due_nsec = replay->start_nsec + (int64_t) record->nsec;
+		int64_t now = now_nsec();
+		if (due_nsec > now) {
+			wl_event_source_timer_update(replay->timer, (due_nsec - now + 999999) / 1000000);
+			return 0;
+		}
+
+		histogram_add(&replay->lateness, now - due_nsec);
+		replay_emit(replay, record, (uint32_t) (now / 1000000));
+		replay->next++;
+	}
+
+	wlr_log(WLR_INFO, "Replayed %zu input events", replay->count);
+	histogram_log(&replay->lateness, "Replay", "lateness");
+	seat_log_stats(replay->seat);
+	return 0;
+}
+
+/* Loads a recording and adds the devices to replay it with. The events
+ * are sent once replay_begin is called. */
+bool
+replay_start(struct cg_seat *seat, const char *path)
+{
+	struct cg_replay *replay = calloc(1, sizeof(*replay));
+	if (!replay) {
+		wlr_log(WLR_ERROR, "Unable to allocate input replay");
+		return false;
+	}
+	replay->seat = seat;
+
+	if (!replay_load(replay, path)) {
+		free(replay->records);
+		free(replay);
+		return false;
+	}
+
+	struct wl_event_loop *event_loop = wl_display_get_event_loop(seat->server->wl_display);
+	replay->timer = wl_event_loop_add_timer(event_loop, handle_replay_timer, replay);
+	if (!replay->timer) {
+		wlr_log(WLR_ERROR, "Unable to create the replay timer");
+		free(replay->records);
+		free(replay);
+		return false;
+	}
+
+	wlr_pointer_init(&replay->pointer, &replay_pointer_impl, replay_pointer_impl.name);
+	wlr_touch_init(&replay->touch, &replay_touch_impl, replay_touch_impl.name);
+	wlr_keyboard_init(&replay->keyboard, &replay_keyboard_impl, replay_keyboard_impl.name);
+	seat->replay = replay;
+	seat_add_device(seat, &replay->pointer.base);
+	seat_add_device(seat, &replay->touch.base);
+	seat_add_device(seat, &replay->keyboard.base);
+
+	wlr_log(WLR_DEBUG, "Loaded %zu input events to replay from %s", replay->count, path);
+	return true;
+}
+
+/* Starts sending the events, relative to now. */
+void
+replay_begin(struct cg_seat *seat)
+{
+	struct cg_replay *replay = seat->replay;
+	if (!replay || replay->start_nsec != 0) {
+		return;
+	}
+
+	wlr_log(WLR_INFO, "Replaying input events");
+	replay->start_nsec = now_nsec();
+	handle_replay_timer(replay);
+}
+
+void
+replay_finish(struct cg_seat *seat)
+{
+	struct cg_replay *replay = seat->replay;
+	if (!replay) {
+		return;
+	}
+
+	wl_event_source_remove(replay->timer);
+	/* These emit the destroy signals that remove the devices from the seat. */
+	wlr_keyboard_finish(&replay->keyboard);
+	wlr_touch_finish(&replay->touch);
+	wlr_pointer_finish(&replay->pointer);
+	free(replay->records);
+	free(replay);
+	seat->replay = NULL;
+}
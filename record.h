@@ -0,0 +1,44 @@
+#ifndef CG_RECORD_H
+#define CG_RECORD_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "seat.h"
+
+enum cg_record_type {
+	CAGE_RECORD_POINTER_MOTION = 1,
+	CAGE_RECORD_POINTER_MOTION_ABSOLUTE,
+	CAGE_RECORD_POINTER_BUTTON,
+	CAGE_RECORD_POINTER_AXIS,
+	CAGE_RECORD_POINTER_FRAME,
+	CAGE_RECORD_TOUCH_DOWN,
+	CAGE_RECORD_TOUCH_UP,
+	CAGE_RECORD_TOUCH_MOTION,
+	CAGE_RECORD_TOUCH_FRAME,
+	CAGE_RECORD_KEY,
+};
+
+/* An input event as it reached the seat. Records have a fixed size and
+ * are stored in host byte order, after a header. */
+struct cg_record {
+	uint64_t nsec; // since the start of the recording
+	uint32_t time_msec;
+	uint32_t type; // enum cg_record_type
+	int32_t a;     // button, key code, touch id or axis source
+	int32_t b;     // button or key state, axis orientation
+	int32_t c;     // axis relative direction
+	int32_t reserved;
+	double x, y;   // motion delta, absolute position, or axis delta and discrete delta
+	double ux, uy; // unaccelerated motion delta
+};
+
+bool record_start(struct cg_seat *seat, const char *path);
+void record_event(struct cg_seat *seat, const struct cg_record *record);
+void record_finish(struct cg_seat *seat);
+
+bool replay_start(struct cg_seat *seat, const char *path);
+void replay_begin(struct cg_seat *seat);
+void replay_finish(struct cg_seat *seat);
+
+#endif
@@ -11,9 +11,14 @@
 #include "config.h"
 
 #include <assert.h>
+#include <fcntl.h>
 #include <linux/input-event-codes.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
 #include <wayland-server-core.h>
 #include <wlr/backend.h>
 #include <wlr/backend/multi.h>
@@ -37,8 +42,11 @@
 #endif
 
 #include "output.h"
+#include "record.h"
 #include "seat.h"
 #include "server.h"
+#include "stats.h"
+#include "trace.h"
 #include "view.h"
 #if CAGE_HAS_XWAYLAND
 #include "xwayland.h"
@@ -57,9 +65,68 @@ static void drag_icon_update_position(struct cg_drag_icon *drag_icon);
  * surface. There cannot be a surface without a view, either. It's both or
  * nothing.
  */
+static struct cg_view *
+desktop_top_view(struct cg_server *server)
+{
+	if (!server->hit_test_valid) {
+		server->hit_test_view = NULL;
+
+		/* Children of the scene tree are ordered from bottom to top. */
+		struct wlr_scene_node *node;
+		wl_list_for_each_reverse (node, &server->scene->tree.children, link) {
+			if (node->enabled) {
+				server->hit_test_view = node->data;
+				break;
+			}
+		}
+		server->hit_test_valid = true;
+	}
+	return server->hit_test_view;
+}
+
+/* In the common case, the topmost view consists of its main surface only:
+ * no subsurfaces, no popups and no drag icon above it. If the point is
+ * on that surface, it is the answer without walking the scene. */
+static struct cg_view *
+desktop_view_at_fast(struct cg_server *server, double lx, double ly, struct wlr_surface **surface, double *sx,
+		     double *sy)
+{
+	struct cg_view *view = desktop_top_view(server);
+	if (!view || !view->wlr_surface) {
+		return NULL;
+	}
+
+	struct wl_list *children = &view->scene_tree->children;
+	if (wl_list_empty(children) || children->next != children->prev) {
+		return NULL;
+	}
+	struct wlr_scene_node *node = wl_container_of(children->next, node, link);
+	if (node->type != WLR_SCENE_NODE_BUFFER || !node->enabled) {
+		return NULL;
+	}
+
+	double x = lx - view->scene_tree->node.x - node->x;
+	double y = ly - view->scene_tree->node.y - node->y;
+	if (!wlr_surface_point_accepts_input(view->wlr_surface, x, y)) {
+		return NULL;
+	}
+
+	*surface = view->wlr_surface;
+	*sx = x;
+	*sy = y;
+	return view;
+}
+
 static struct cg_view *
 desktop_view_at(struct cg_server *server, double lx, double ly, struct wlr_surface **surface, double *sx, double *sy)
 {
+	CG_TRACE2(view_at, (int) lx, (int) ly);
+	struct cg_view *view = desktop_view_at_fast(server, lx, ly, surface, sx, sy);
+	if (view) {
+		CG_TRACE1(view_at_fast, view);
+		return view;
+	}
+
 	struct wlr_scene_node *node = wlr_scene_node_at(&server->scene->tree.node, lx, ly, sx, sy);
 	if (node == NULL || node->type != WLR_SCENE_NODE_BUFFER) {
 		return NULL;
@@ -130,8 +197,28 @@ update_capabilities(struct cg_seat *seat)
 	/* Hide cursor if the seat doesn't have pointer capability. */
 	if ((caps & WL_SEAT_CAPABILITY_POINTER) == 0) {
 		wlr_cursor_unset_image(seat->cursor);
+	} else if (!seat->cursor_hidden) {
+		wlr_cursor_set_xcursor(seat->cursor, seat->server->xcursor_manager, DEFAULT_XCURSOR);
+	}
+}
+
+/* A visible cursor that cannot go on a hardware plane forces composition,
+ * so in scanout mode we hide it while the user is interacting through touch.
+ * When it comes back, pointer focus is reset so that the client sets its
+ * cursor image again on enter. */
+static void
+seat_set_cursor_hidden(struct cg_seat *seat, bool hidden)
+{
+	if (seat->cursor_hidden == hidden) {
+		return;
+	}
+	seat->cursor_hidden = hidden;
+
+	if (hidden) {
+		wlr_cursor_unset_image(seat->cursor);
 	} else {
 		wlr_cursor_set_xcursor(seat->cursor, seat->server->xcursor_manager, DEFAULT_XCURSOR);
+		wlr_seat_pointer_clear_focus(seat->seat);
 	}
 }
 
@@ -245,13 +332,136 @@ handle_virtual_pointer(struct wl_listener *listener, void *data)
 	update_capabilities(seat);
 }
 
+/* Activity is reported to idle-notify clients at most this often. */
+#define ACTIVITY_INTERVAL_MSEC 100
+
+static void
+seat_flush_activity(struct cg_seat *seat)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	seat->activity_notified_nsec = timespec_to_nsec(&now);
+	seat->activity_pending = false;
+
+	wlr_idle_notifier_v1_notify_activity(seat->server->idle, seat->seat);
+}
+
+static int
+handle_activity_timer(void *data)
+{
+	struct cg_seat *seat = data;
+	if (seat->activity_pending) {
+		seat_flush_activity(seat);
+	}
+	return 0;
+}
+
+/* Every notification resets the timers of all idle-notify clients, and
+ * nearly every input event is activity. The first activity after a quiet
+ * period is reported right away; any further activity is reported once
+ * the interval has passed. */
+static void
+seat_notify_activity(struct cg_seat *seat)
+{
+	if (seat->activity_pending) {
+		return;
+	}
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t elapsed_msec = (timespec_to_nsec(&now) - seat->activity_notified_nsec) / 1000000;
+	if (elapsed_msec >= ACTIVITY_INTERVAL_MSEC || !seat->activity_timer) {
+		seat_flush_activity(seat);
+		return;
+	}
+
+	seat->activity_pending = true;
+	wl_event_source_timer_update(seat->activity_timer, ACTIVITY_INTERVAL_MSEC - (int) elapsed_msec);
+}
+
 static void
 handle_modifier_event(struct wlr_keyboard *keyboard, struct cg_seat *seat)
 {
 	wlr_seat_set_keyboard(seat->seat, keyboard);
 	wlr_seat_keyboard_notify_modifiers(seat->seat, &keyboard->modifiers);
 
-	wlr_idle_notifier_v1_notify_activity(seat->server->idle, seat->seat);
+	seat_notify_activity(seat);
+}
+
+static void
+handle_input_flush_idle(void *data)
+{
+	struct cg_seat *seat = data;
+	seat->input_flush_idle = NULL;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t now_nsec = timespec_to_nsec(&now);
+
+	for (int i = 0; i < CAGE_INPUT_TYPE_COUNT; i++) {
+		struct cg_input_latency *latency = &seat->input_latency[i];
+		for (int j = 0; j < latency->pending_count; j++) {
+			histogram_add(&latency->flush, now_nsec - latency->pending[j]);
+		}
+		latency->pending_count = 0;
+	}
+}
+
+/* Called when an input event reaches its listener. Returns the time, to
+ * be passed to input_event_end once the event has been sent on. */
+static int64_t
+input_event_begin(struct cg_seat *seat, enum cg_input_type type, uint32_t time_msec)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t now_nsec = timespec_to_nsec(&now);
+
+	/* libinput timestamps are CLOCK_MONOTONIC milliseconds, truncated to
+	 * 32 bits. Virtual devices may use anything, so ignore nonsense. */
+	uint32_t skew_msec = (uint32_t) (now_nsec / 1000000) - time_msec;
+	if (skew_msec < 60000) {
+		histogram_add(&seat->input_latency[type].skew, (int64_t) skew_msec * 1000000);
+	}
+
+	return now_nsec;
+}
+
+static void
+input_event_end(struct cg_seat *seat, enum cg_input_type type, int64_t begin_nsec)
+{
+	struct cg_input_latency *latency = &seat->input_latency[type];
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	histogram_add(&latency->dispatch, timespec_to_nsec(&now) - begin_nsec);
+
+	if (latency->pending_count < CG_INPUT_PENDING_MAX) {
+		latency->pending[latency->pending_count++] = begin_nsec;
+	}
+
+	/* Idle sources run at the end of the event loop iteration; the
+	 * display flushes the clients right after. */
+	if (!seat->input_flush_idle) {
+		struct wl_event_loop *event_loop = wl_display_get_event_loop(seat->server->wl_display);
+		seat->input_flush_idle = wl_event_loop_add_idle(event_loop, handle_input_flush_idle, seat);
+	}
+}
+
+void
+seat_log_stats(struct cg_seat *seat)
+{
+	static const char *names[CAGE_INPUT_TYPE_COUNT] = {
+		[CAGE_INPUT_KEYBOARD] = "Keyboard",
+		[CAGE_INPUT_POINTER] = "Pointer",
+		[CAGE_INPUT_TOUCH] = "Touch",
+	};
+
+	for (int i = 0; i < CAGE_INPUT_TYPE_COUNT; i++) {
+		struct cg_input_latency *latency = &seat->input_latency[i];
+		histogram_log(&latency->skew, names[i], "event timestamp to listener");
+		histogram_log(&latency->dispatch, names[i], "listener to client notified");
+		histogram_log(&latency->flush, names[i], "listener to flush");
+	}
 }
 
 static bool
@@ -273,7 +483,7 @@ handle_keybinding(struct cg_server *server, xkb_keysym_t sym)
 	} else {
 		return false;
 	}
-	wlr_idle_notifier_v1_notify_activity(server->idle, server->seat->seat);
+	seat_notify_activity(server->seat);
 	return true;
 }
 
@@ -281,6 +491,14 @@ static void
 handle_key_event(struct wlr_keyboard *keyboard, struct cg_seat *seat, void *data)
 {
 	struct wlr_keyboard_key_event *event = data;
+	int64_t begin = input_event_begin(seat, CAGE_INPUT_KEYBOARD, event->time_msec);
+	struct cg_record record = {
+		.type = CAGE_RECORD_KEY,
+		.time_msec = event->time_msec,
+		.a = event->keycode,
+		.b = event->state,
+	};
+	record_event(seat, &record);
 
 	/* Translate from libinput keycode to an xkbcommon keycode. */
 	xkb_keycode_t keycode = event->keycode + 8;
@@ -305,7 +523,8 @@ handle_key_event(struct wlr_keyboard *keyboard, struct cg_seat *seat, void *data
 		wlr_seat_keyboard_notify_key(seat->seat, event->time_msec, event->keycode, event->state);
 	}
 
-	wlr_idle_notifier_v1_notify_activity(seat->server->idle, seat->seat);
+	input_event_end(seat, CAGE_INPUT_KEYBOARD, begin);
+	seat_notify_activity(seat);
 }
 
 static void
@@ -391,26 +610,159 @@ keyboard_group_destroy(struct cg_keyboard_group *keyboard_group)
 	free(keyboard_group);
 }
 
+static bool
+names_equal(const char *a, const char *b)
+{
+	return (a == NULL && b == NULL) || (a != NULL && b != NULL && strcmp(a, b) == 0);
+}
+
+static char *
+names_dup(const char *name)
+{
+	return name ? strdup(name) : NULL;
+}
+
 static void
-handle_new_keyboard(struct cg_seat *seat, struct wlr_keyboard *keyboard, bool virtual)
+keymap_destroy(struct cg_keymap *keymap)
 {
-	struct xkb_context *context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
-	if (!context) {
-		wlr_log(WLR_ERROR, "Unable to create XKB context");
-		return;
+	wl_list_remove(&keymap->link);
+	xkb_keymap_unref(keymap->keymap);
+	free((char *) keymap->names.rules);
+	free((char *) keymap->names.model);
+	free((char *) keymap->names.layout);
+	free((char *) keymap->names.variant);
+	free((char *) keymap->names.options);
+	free(keymap);
+}
+
+/* Loads a keymap serialized in the text format, as written by
+ * xkbcli compile-keymap. Such a keymap is self-contained, so the include
+ * paths don't need to be scanned. */
+static struct xkb_keymap *
+load_keymap_file(const char *path)
+{
+	struct xkb_keymap *keymap = NULL;
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		wlr_log_errno(WLR_ERROR, "Unable to open keymap %s", path);
+		return NULL;
 	}
 
-	struct xkb_keymap *keymap = xkb_keymap_new_from_names(context, NULL, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size <= 0) {
+		wlr_log(WLR_ERROR, "Keymap %s is empty", path);
+		goto out_close;
+	}
+
+	void *data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	if (data == MAP_FAILED) {
+		wlr_log_errno(WLR_ERROR, "Unable to map keymap %s", path);
+		goto out_close;
+	}
+
+	struct xkb_context *context =
+		xkb_context_new(XKB_CONTEXT_NO_DEFAULT_INCLUDES | XKB_CONTEXT_NO_ENVIRONMENT_NAMES);
+	if (context) {
+		keymap = xkb_keymap_new_from_buffer(context, data, st.st_size, XKB_KEYMAP_FORMAT_TEXT_V1,
+						    XKB_KEYMAP_COMPILE_NO_FLAGS);
+		/* The keymap holds on to the context. */
+		xkb_context_unref(context);
+	}
 	if (!keymap) {
+		wlr_log(WLR_ERROR, "Unable to load keymap %s", path);
+	}
+
+	munmap(data, st.st_size);
+out_close:
+	close(fd);
+	return keymap;
+}
+
+/* Compiling a keymap takes milliseconds, so keymaps are compiled once per
+ * set of rules, model, layout, variant and options and shared by all
+ * keyboards, including virtual ones and keyboards that are plugged in
+ * later. The returned keymap is owned by the seat. */
+static struct xkb_keymap *
+seat_get_keymap(struct cg_seat *seat)
+{
+	const char *keymap_file = seat->server->keymap_file;
+	if (keymap_file && !seat->file_keymap && !seat->file_keymap_failed) {
+		CG_TRACE1(keymap_compile_begin, keymap_file);
+		seat->file_keymap = load_keymap_file(keymap_file);
+		CG_TRACE1(keymap_compile_end, seat->file_keymap);
+		if (!seat->file_keymap) {
+			wlr_log(WLR_ERROR, "Falling back to the XKB_DEFAULT_* keymap");
+			seat->file_keymap_failed = true;
+		} else {
+			seat->keymap_compiles++;
+		}
+	}
+	if (seat->file_keymap) {
+		return seat->file_keymap;
+	}
+
+	/* These are what xkbcommon would use for a keymap without names. */
+	struct xkb_rule_names names = {
+		.rules = getenv("XKB_DEFAULT_RULES"),
+		.model = getenv("XKB_DEFAULT_MODEL"),
+		.layout = getenv("XKB_DEFAULT_LAYOUT"),
+		.variant = getenv("XKB_DEFAULT_VARIANT"),
+		.options = getenv("XKB_DEFAULT_OPTIONS"),
+	};
+
+	struct cg_keymap *keymap;
+	wl_list_for_each (keymap, &seat->keymaps, link) {
+		if (names_equal(keymap->names.rules, names.rules) && names_equal(keymap->names.model, names.model) &&
+		    names_equal(keymap->names.layout, names.layout) &&
+		    names_equal(keymap->names.variant, names.variant) &&
+		    names_equal(keymap->names.options, names.options)) {
+			return keymap->keymap;
+		}
+	}
+
+	if (!seat->xkb_context) {
+		seat->xkb_context = xkb_context_new(XKB_CONTEXT_NO_FLAGS);
+		if (!seat->xkb_context) {
+			wlr_log(WLR_ERROR, "Unable to create XKB context");
+			return NULL;
+		}
+	}
+
+	keymap = calloc(1, sizeof(*keymap));
+	if (!keymap) {
+		wlr_log(WLR_ERROR, "Unable to allocate keymap");
+		return NULL;
+	}
+
+	CG_TRACE1(keymap_compile_begin, names.layout);
+	keymap->keymap = xkb_keymap_new_from_names(seat->xkb_context, &names, XKB_KEYMAP_COMPILE_NO_FLAGS);
+	CG_TRACE1(keymap_compile_end, keymap->keymap);
+	if (!keymap->keymap) {
 		wlr_log(WLR_ERROR, "Unable to configure keyboard: keymap does not exist");
-		xkb_context_unref(context);
+		free(keymap);
+		return NULL;
+	}
+	seat->keymap_compiles++;
+	keymap->names.rules = names_dup(names.rules);
+	keymap->names.model = names_dup(names.model);
+	keymap->names.layout = names_dup(names.layout);
+	keymap->names.variant = names_dup(names.variant);
+	keymap->names.options = names_dup(names.options);
+	wl_list_insert(&seat->keymaps, &keymap->link);
+
+	return keymap->keymap;
+}
+
+static void
+handle_new_keyboard(struct cg_seat *seat, struct wlr_keyboard *keyboard, bool virtual)
+{
+	struct xkb_keymap *keymap = seat_get_keymap(seat);
+	if (!keymap) {
 		return;
 	}
 
 	wlr_keyboard_set_keymap(keyboard, keymap);
-
-	xkb_keymap_unref(keymap);
-	xkb_context_unref(context);
 	wlr_keyboard_set_repeat_info(keyboard, 25, 600);
 
 	cg_keyboard_group_add(keyboard, seat, virtual);
@@ -433,12 +785,9 @@ handle_virtual_keyboard(struct wl_listener *listener, void *data)
 	update_capabilities(seat);
 }
 
-static void
-handle_new_input(struct wl_listener *listener, void *data)
+void
+seat_add_device(struct cg_seat *seat, struct wlr_input_device *device)
 {
-	struct cg_seat *seat = wl_container_of(listener, seat, new_input);
-	struct wlr_input_device *device = data;
-
 	switch (device->type) {
 	case WLR_INPUT_DEVICE_KEYBOARD:
 		handle_new_keyboard(seat, wlr_keyboard_from_input_device(device), false);
@@ -461,6 +810,13 @@ handle_new_input(struct wl_listener *listener, void *data)
 	update_capabilities(seat);
 }
 
+static void
+handle_new_input(struct wl_listener *listener, void *data)
+{
+	struct cg_seat *seat = wl_container_of(listener, seat, new_input);
+	seat_add_device(seat, data);
+}
+
 static void
 handle_request_set_primary_selection(struct wl_listener *listener, void *data)
 {
@@ -501,7 +857,7 @@ handle_request_set_cursor(struct wl_listener *listener, void *data)
 	/* This can be sent by any client, so we check to make sure
 	 * this one actually has pointer focus first. */
 	if (client_has_pointer_focus(seat, event->seat_client->client) &&
-	    (seat->seat->capabilities & WL_SEAT_CAPABILITY_POINTER) != 0) {
+	    (seat->seat->capabilities & WL_SEAT_CAPABILITY_POINTER) != 0 && !seat->cursor_hidden) {
 		wlr_cursor_set_surface(seat->cursor, event->surface, event->hotspot_x, event->hotspot_y);
 	}
 }
@@ -516,17 +872,215 @@ handle_request_set_shape(struct wl_listener *listener, void *data)
 	/* This can be sent by any client, so we check to make sure
 	 * this one actually has pointer focus first. */
 	if (client_has_pointer_focus(seat, event->seat_client->client) &&
-	    (seat->seat->capabilities & WL_SEAT_CAPABILITY_POINTER) != 0) {
+	    (seat->seat->capabilities & WL_SEAT_CAPABILITY_POINTER) != 0 && !seat->cursor_hidden) {
 		const char *shape_name = wlr_cursor_shape_v1_name(event->shape);
 		wlr_cursor_set_xcursor(seat->cursor, seat->server->xcursor_manager, shape_name);
 	}
 }
 
+static void
+touch_notify_motion(struct cg_seat *seat, uint32_t time_msec, int32_t touch_id, double lx, double ly)
+{
+	double sx, sy;
+	struct wlr_surface *surface;
+	struct cg_view *view = desktop_view_at(seat->server, lx, ly, &surface, &sx, &sy);
+
+	if (view) {
+		wlr_seat_touch_point_focus(seat->seat, surface, time_msec, touch_id, sx, sy);
+		wlr_seat_touch_notify_motion(seat->seat, time_msec, touch_id, sx, sy);
+	} else {
+		wlr_seat_touch_point_clear_focus(seat->seat, time_msec, touch_id);
+	}
+
+	if (touch_id == seat->touch_id) {
+		seat->touch_lx = lx;
+		seat->touch_ly = ly;
+	}
+}
+
+/* Samples older than this are taken to be the start of a new movement. */
+#define TOUCH_RESAMPLE_MAX_GAP_NSEC 20000000
+/* Resample this far before the output frame, so that there usually is a
+ * sample on either side of the resampling time. */
+#define TOUCH_RESAMPLE_LATENCY_NSEC 5000000
+
+static struct cg_touch_track *
+touch_track_get(struct cg_seat *seat, int32_t touch_id, bool create)
+{
+	struct cg_touch_track *free_track = NULL;
+	for (int i = 0; i < CG_TOUCH_RESAMPLE_POINTS; i++) {
+		struct cg_touch_track *track = &seat->touch_tracks[i];
+		if (track->active && track->touch_id == touch_id) {
+			return track;
+		} else if (!track->active && !free_track) {
+			free_track = track;
+		}
+	}
+
+	if (!create || !free_track) {
+		return NULL;
+	}
+	*free_track = (struct cg_touch_track){.active = true, .touch_id = touch_id};
+	return free_track;
+}
+
+/* Converts a 32-bit CLOCK_MONOTONIC millisecond event timestamp. */
+static int64_t
+event_time_to_nsec(uint32_t time_msec)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t now_nsec = timespec_to_nsec(&now);
+
+	uint32_t age_msec = (uint32_t) (now_nsec / 1000000) - time_msec;
+	if (age_msec > 1000) {
+		return now_nsec;
+	}
+	return now_nsec - (int64_t) age_msec * 1000000;
+}
+
+static void
+touch_queue_motion(struct cg_seat *seat, uint32_t time_msec, int32_t touch_id, double lx, double ly)
+{
+	struct cg_touch_track *track = touch_track_get(seat, touch_id, true);
+	if (!track) {
+		touch_notify_motion(seat, time_msec, touch_id, lx, ly);
+		return;
+	}
+
+	struct cg_touch_sample sample = {event_time_to_nsec(time_msec), lx, ly};
+	if (track->sample_count > 0 && sample.time_nsec - track->samples[1].time_nsec > TOUCH_RESAMPLE_MAX_GAP_NSEC) {
+		track->sample_count = 0;
+	}
+	track->samples[0] = track->samples[1];
+	track->samples[1] = sample;
+	if (track->sample_count < 2) {
+		track->sample_count++;
+	}
+	track->pending = true;
+	seat->touch_motion_pending = true;
+
+	/* Make sure a frame comes, even if nothing on screen changes. */
+	struct wlr_output *wlr_output = wlr_output_layout_output_at(seat->server->output_layout, lx, ly);
+	if (wlr_output) {
+		wlr_output_schedule_frame(wlr_output);
+	}
+}
+
+static void
+touch_track_send(struct cg_seat *seat, struct cg_touch_track *track, int64_t target_nsec)
+{
+	const struct cg_touch_sample *a = &track->samples[0];
+	const struct cg_touch_sample *b = &track->samples[1];
+	struct cg_touch_sample out = *b;
+
+	/* Don't go back in time relative to what was sent before. */
+	if (target_nsec < track->sent_nsec) {
+		target_nsec = track->sent_nsec;
+	}
+
+	int64_t dt = b->time_nsec - a->time_nsec;
+	if (track->sample_count == 2 && dt > 0) {
+		/* Never extrapolate: it overshoots whenever the point changes
+		 * direction. Past the latest sample, that sample is sent. */
+		if (target_nsec > b->time_nsec) {
+			target_nsec = b->time_nsec;
+		}
+		if (target_nsec > a->time_nsec) {
+			double alpha = (double) (target_nsec - a->time_nsec) / (double) dt;
+			out.time_nsec = target_nsec;
+			out.lx = a->lx + (b->lx - a->lx) * alpha;
+			out.ly = a->ly + (b->ly - a->ly) * alpha;
+		}
+	}
+
+	track->pending = false;
+	track->sent_nsec = out.time_nsec;
+	touch_notify_motion(seat, (uint32_t) (out.time_nsec / 1000000), track->touch_id, out.lx, out.ly);
+}
+
+/* Sends the position of every moved touch point as it was at
+ * TOUCH_RESAMPLE_LATENCY_NSEC before frame_nsec, interpolated between its
+ * two latest samples. Called for each output frame, so that clients get
+ * one evenly spaced update per refresh rather than samples at the panel's
+ * own irregular rate. */
+void
+seat_resample_touch(struct cg_seat *seat, int64_t frame_nsec)
+{
+	if (!seat->touch_motion_pending) {
+		return;
+	}
+	seat->touch_motion_pending = false;
+
+	int64_t target_nsec = frame_nsec - TOUCH_RESAMPLE_LATENCY_NSEC;
+	for (int i = 0; i < CG_TOUCH_RESAMPLE_POINTS; i++) {
+		struct cg_touch_track *track = &seat->touch_tracks[i];
+		if (track->active && track->pending) {
+			touch_track_send(seat, track, target_nsec);
+		}
+	}
+	wlr_seat_touch_notify_frame(seat->seat);
+}
+
+/* Sends the latest sample of a touch point, if it hasn't been sent. */
+static void
+touch_track_flush(struct cg_seat *seat, struct cg_touch_track *track)
+{
+	if (track->pending) {
+		const struct cg_touch_sample *sample = &track->samples[1];
+		track->pending = false;
+		track->sent_nsec = sample->time_nsec;
+		touch_notify_motion(seat, (uint32_t) (sample->time_nsec / 1000000), track->touch_id, sample->lx,
+				    sample->ly);
+	}
+}
+
+/* Sends the latest sample of a touch point that is about to go up. */
+static void
+touch_track_finish(struct cg_seat *seat, int32_t touch_id)
+{
+	struct cg_touch_track *track = touch_track_get(seat, touch_id, false);
+	if (!track) {
+		return;
+	}
+	touch_track_flush(seat, track);
+	track->active = false;
+
+	seat->touch_motion_pending = false;
+	for (int i = 0; i < CG_TOUCH_RESAMPLE_POINTS; i++) {
+		if (seat->touch_tracks[i].active && seat->touch_tracks[i].pending) {
+			seat->touch_motion_pending = true;
+		}
+	}
+}
+
 static void
 handle_touch_down(struct wl_listener *listener, void *data)
 {
 	struct cg_seat *seat = wl_container_of(listener, seat, touch_down);
 	struct wlr_touch_down_event *event = data;
+	int64_t begin = input_event_begin(seat, CAGE_INPUT_TOUCH, event->time_msec);
+	struct cg_record record = {
+		.type = CAGE_RECORD_TOUCH_DOWN,
+		.time_msec = event->time_msec,
+		.a = event->touch_id,
+		.x = event->x,
+		.y = event->y,
+	};
+	record_event(seat, &record);
+
+	if (seat->server->touch_resample) {
+		/* A new touch starts without history. */
+		struct cg_touch_track *track = touch_track_get(seat, event->touch_id, false);
+		if (track) {
+			track->active = false;
+		}
+		seat->touch_frame_contact = true;
+	}
+
+	if (seat->server->scanout_mode) {
+		seat_set_cursor_hidden(seat, true);
+	}
 
 	double lx, ly;
 	wlr_cursor_absolute_to_layout_coords(seat->cursor, &event->touch->base, event->x, event->y, &lx, &ly);
@@ -547,7 +1101,8 @@ handle_touch_down(struct wl_listener *listener, void *data)
 		press_cursor_button(seat, &event->touch->base, event->time_msec, BTN_LEFT, WLR_BUTTON_PRESSED, lx, ly);
 	}
 
-	wlr_idle_notifier_v1_notify_activity(seat->server->idle, seat->seat);
+	input_event_end(seat, CAGE_INPUT_TOUCH, begin);
+	seat_notify_activity(seat);
 }
 
 static void
@@ -555,18 +1110,31 @@ handle_touch_up(struct wl_listener *listener, void *data)
 {
 	struct cg_seat *seat = wl_container_of(listener, seat, touch_up);
 	struct wlr_touch_up_event *event = data;
+	int64_t begin = input_event_begin(seat, CAGE_INPUT_TOUCH, event->time_msec);
+	struct cg_record record = {
+		.type = CAGE_RECORD_TOUCH_UP,
+		.time_msec = event->time_msec,
+		.a = event->touch_id,
+	};
+	record_event(seat, &record);
 
 	if (!wlr_seat_touch_get_point(seat->seat, event->touch_id)) {
 		return;
 	}
 
+	if (seat->server->touch_resample) {
+		touch_track_finish(seat, event->touch_id);
+		seat->touch_frame_contact = true;
+	}
+
 	if (wlr_seat_touch_num_points(seat->seat) == 1) {
 		press_cursor_button(seat, &event->touch->base, event->time_msec, BTN_LEFT, WLR_BUTTON_RELEASED,
 				    seat->touch_lx, seat->touch_ly);
 	}
 
 	wlr_seat_touch_notify_up(seat->seat, event->time_msec, event->touch_id);
-	wlr_idle_notifier_v1_notify_activity(seat->server->idle, seat->seat);
+	input_event_end(seat, CAGE_INPUT_TOUCH, begin);
+	seat_notify_activity(seat);
 }
 
 static void
@@ -574,6 +1142,15 @@ handle_touch_motion(struct wl_listener *listener, void *data)
 {
 	struct cg_seat *seat = wl_container_of(listener, seat, touch_motion);
 	struct wlr_touch_motion_event *event = data;
+	int64_t begin = input_event_begin(seat, CAGE_INPUT_TOUCH, event->time_msec);
+	struct cg_record record = {
+		.type = CAGE_RECORD_TOUCH_MOTION,
+		.time_msec = event->time_msec,
+		.a = event->touch_id,
+		.x = event->x,
+		.y = event->y,
+	};
+	record_event(seat, &record);
 
 	if (!wlr_seat_touch_get_point(seat->seat, event->touch_id)) {
 		return;
@@ -582,41 +1159,57 @@ handle_touch_motion(struct wl_listener *listener, void *data)
 	double lx, ly;
 	wlr_cursor_absolute_to_layout_coords(seat->cursor, &event->touch->base, event->x, event->y, &lx, &ly);
 
-	double sx, sy;
-	struct wlr_surface *surface;
-	struct cg_view *view = desktop_view_at(seat->server, lx, ly, &surface, &sx, &sy);
-
-	if (view) {
-		wlr_seat_touch_point_focus(seat->seat, surface, event->time_msec, event->touch_id, sx, sy);
-		wlr_seat_touch_notify_motion(seat->seat, event->time_msec, event->touch_id, sx, sy);
+	if (seat->server->touch_resample) {
+		touch_queue_motion(seat, event->time_msec, event->touch_id, lx, ly);
 	} else {
-		wlr_seat_touch_point_clear_focus(seat->seat, event->time_msec, event->touch_id);
+		touch_notify_motion(seat, event->time_msec, event->touch_id, lx, ly);
 	}
 
-	if (event->touch_id == seat->touch_id) {
-		seat->touch_lx = lx;
-		seat->touch_ly = ly;
-	}
+	input_event_end(seat, CAGE_INPUT_TOUCH, begin);
 
-	wlr_idle_notifier_v1_notify_activity(seat->server->idle, seat->seat);
+	seat_notify_activity(seat);
 }
 
 static void
 handle_touch_frame(struct wl_listener *listener, void *data)
 {
 	struct cg_seat *seat = wl_container_of(listener, seat, touch_frame);
+	record_event(seat, &(struct cg_record){.type = CAGE_RECORD_TOUCH_FRAME});
+
+	/* The frame of resampled motion is sent along with it. A frame with a
+	 * point going down or up can't wait for the output frame, so the motion
+	 * of the other points is flushed into it. */
+	if (seat->touch_motion_pending && seat->touch_frame_contact) {
+		for (int i = 0; i < CG_TOUCH_RESAMPLE_POINTS; i++) {
+			if (seat->touch_tracks[i].active) {
+				touch_track_flush(seat, &seat->touch_tracks[i]);
+			}
+		}
+		seat->touch_motion_pending = false;
+	}
+	seat->touch_frame_contact = false;
 
-	wlr_seat_touch_notify_frame(seat->seat);
-	wlr_idle_notifier_v1_notify_activity(seat->server->idle, seat->seat);
+	if (!seat->touch_motion_pending) {
+		wlr_seat_touch_notify_frame(seat->seat);
+	}
+	seat_notify_activity(seat);
 }
 
+static void seat_flush_pointer_motion(struct cg_seat *seat, bool send_frame);
+
 static void
 handle_cursor_frame(struct wl_listener *listener, void *data)
 {
 	struct cg_seat *seat = wl_container_of(listener, seat, cursor_frame);
+	record_event(seat, &(struct cg_record){.type = CAGE_RECORD_POINTER_FRAME});
 
-	wlr_seat_pointer_notify_frame(seat->seat);
-	wlr_idle_notifier_v1_notify_activity(seat->server->idle, seat->seat);
+	/* The frame of coalesced motion is sent when the motion is, but
+	 * clients only act on relative motion once it is framed. */
+	if (!seat->motion_pending || seat->relative_motion_unframed) {
+		seat->relative_motion_unframed = false;
+		wlr_seat_pointer_notify_frame(seat->seat);
+	}
+	seat_notify_activity(seat);
 }
 
 static void
@@ -624,10 +1217,23 @@ handle_cursor_axis(struct wl_listener *listener, void *data)
 {
 	struct cg_seat *seat = wl_container_of(listener, seat, cursor_axis);
 	struct wlr_pointer_axis_event *event = data;
-
+	int64_t begin = input_event_begin(seat, CAGE_INPUT_POINTER, event->time_msec);
+	struct cg_record record = {
+		.type = CAGE_RECORD_POINTER_AXIS,
+		.time_msec = event->time_msec,
+		.a = event->source,
+		.b = event->orientation,
+		.c = event->relative_direction,
+		.x = event->delta,
+		.y = event->delta_discrete,
+	};
+	record_event(seat, &record);
+
+	seat_flush_pointer_motion(seat, true);
 	wlr_seat_pointer_notify_axis(seat->seat, event->time_msec, event->orientation, event->delta,
 				     event->delta_discrete, event->source, event->relative_direction);
-	wlr_idle_notifier_v1_notify_activity(seat->server->idle, seat->seat);
+	input_event_end(seat, CAGE_INPUT_POINTER, begin);
+	seat_notify_activity(seat);
 }
 
 static void
@@ -635,11 +1241,22 @@ handle_cursor_button(struct wl_listener *listener, void *data)
 {
 	struct cg_seat *seat = wl_container_of(listener, seat, cursor_button);
 	struct wlr_pointer_button_event *event = data;
-
+	int64_t begin = input_event_begin(seat, CAGE_INPUT_POINTER, event->time_msec);
+	struct cg_record record = {
+		.type = CAGE_RECORD_POINTER_BUTTON,
+		.time_msec = event->time_msec,
+		.a = event->button,
+		.b = event->state,
+	};
+	record_event(seat, &record);
+
+	seat_set_cursor_hidden(seat, false);
+	seat_flush_pointer_motion(seat, true);
 	wlr_seat_pointer_notify_button(seat->seat, event->time_msec, event->button, event->state);
 	press_cursor_button(seat, &event->pointer->base, event->time_msec, event->button, event->state, seat->cursor->x,
 			    seat->cursor->y);
-	wlr_idle_notifier_v1_notify_activity(seat->server->idle, seat->seat);
+	input_event_end(seat, CAGE_INPUT_POINTER, begin);
+	seat_notify_activity(seat);
 }
 
 static void
@@ -650,6 +1267,7 @@ process_cursor_motion(struct cg_seat *seat, uint32_t time_msec, double dx, doubl
 	struct wlr_seat *wlr_seat = seat->seat;
 	struct wlr_surface *surface = NULL;
 
+	CG_TRACE1(cursor_motion, time_msec);
 	struct cg_view *view = desktop_view_at(seat->server, seat->cursor->x, seat->cursor->y, &surface, &sx, &sy);
 	if (!view) {
 		wlr_seat_pointer_clear_focus(wlr_seat);
@@ -668,8 +1286,84 @@ process_cursor_motion(struct cg_seat *seat, uint32_t time_msec, double dx, doubl
 	wl_list_for_each (drag_icon, &seat->drag_icons, link) {
 		drag_icon_update_position(drag_icon);
 	}
+}
 
-	wlr_idle_notifier_v1_notify_activity(seat->server->idle, seat->seat);
+/* Sends the cursor position accumulated since the last flush to the
+ * surface under the cursor. */
+static void
+seat_flush_pointer_motion(struct cg_seat *seat, bool send_frame)
+{
+	if (!seat->motion_pending) {
+		return;
+	}
+	seat->motion_pending = false;
+	seat->motion_flushes++;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	seat->motion_flushed_nsec = timespec_to_nsec(&now);
+
+	process_cursor_motion(seat, seat->motion_time_msec, 0, 0, 0, 0);
+	if (send_frame) {
+		seat->relative_motion_unframed = false;
+		wlr_seat_pointer_notify_frame(seat->seat);
+	}
+}
+
+static int
+handle_motion_timer(void *data)
+{
+	struct cg_seat *seat = data;
+	seat_flush_pointer_motion(seat, true);
+	return 0;
+}
+
+/* Returns the refresh interval of the fastest enabled output. */
+static int
+seat_motion_interval(struct cg_seat *seat)
+{
+	int32_t refresh = 0;
+	struct cg_output *output;
+	wl_list_for_each (output, &seat->server->outputs, link) {
+		if (output->wlr_output->enabled && output->wlr_output->refresh > refresh) {
+			refresh = output->wlr_output->refresh;
+		}
+	}
+	return refresh > 0 ? 1000000 / refresh : 16;
+}
+
+/* Relative motion is forwarded right away and framed by the frame event
+ * that follows it, so that clients using relative-pointer see every delta
+ * without delay; hit-testing and absolute motion are deferred until an
+ * output refresh interval has passed since the last flush. */
+static void
+seat_queue_pointer_motion(struct cg_seat *seat, uint32_t time_msec, double dx, double dy, double dx_unaccel,
+			  double dy_unaccel)
+{
+	if (dx != 0 || dy != 0) {
+		wlr_relative_pointer_manager_v1_send_relative_motion(seat->server->relative_pointer_manager, seat->seat,
+								     (uint64_t) time_msec * 1000, dx, dy, dx_unaccel,
+								     dy_unaccel);
+		seat->relative_motion_unframed = true;
+	}
+
+	seat->motion_events++;
+	seat->motion_time_msec = time_msec;
+	if (seat->motion_pending) {
+		return;
+	}
+	seat->motion_pending = true;
+
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t elapsed_msec = (timespec_to_nsec(&now) - seat->motion_flushed_nsec) / 1000000;
+	int interval = seat_motion_interval(seat);
+	if (elapsed_msec >= interval || !seat->motion_timer) {
+		/* The frame of this event follows. */
+		seat_flush_pointer_motion(seat, false);
+		return;
+	}
+	wl_event_source_timer_update(seat->motion_timer, interval - (int) elapsed_msec);
 }
 
 static void
@@ -677,6 +1371,14 @@ handle_cursor_motion_absolute(struct wl_listener *listener, void *data)
 {
 	struct cg_seat *seat = wl_container_of(listener, seat, cursor_motion_absolute);
 	struct wlr_pointer_motion_absolute_event *event = data;
+	int64_t begin = input_event_begin(seat, CAGE_INPUT_POINTER, event->time_msec);
+	struct cg_record record = {
+		.type = CAGE_RECORD_POINTER_MOTION_ABSOLUTE,
+		.time_msec = event->time_msec,
+		.x = event->x,
+		.y = event->y,
+	};
+	record_event(seat, &record);
 
 	double lx, ly;
 	wlr_cursor_absolute_to_layout_coords(seat->cursor, &event->pointer->base, event->x, event->y, &lx, &ly);
@@ -684,9 +1386,15 @@ handle_cursor_motion_absolute(struct wl_listener *listener, void *data)
 	double dx = lx - seat->cursor->x;
 	double dy = ly - seat->cursor->y;
 
+	seat_set_cursor_hidden(seat, false);
 	wlr_cursor_warp_absolute(seat->cursor, &event->pointer->base, event->x, event->y);
-	process_cursor_motion(seat, event->time_msec, dx, dy, dx, dy);
-	wlr_idle_notifier_v1_notify_activity(seat->server->idle, seat->seat);
+	if (seat->server->coalesce_motion) {
+		seat_queue_pointer_motion(seat, event->time_msec, dx, dy, dx, dy);
+	} else {
+		process_cursor_motion(seat, event->time_msec, dx, dy, dx, dy);
+	}
+	input_event_end(seat, CAGE_INPUT_POINTER, begin);
+	seat_notify_activity(seat);
 }
 
 static void
@@ -694,11 +1402,28 @@ handle_cursor_motion_relative(struct wl_listener *listener, void *data)
 {
 	struct cg_seat *seat = wl_container_of(listener, seat, cursor_motion_relative);
 	struct wlr_pointer_motion_event *event = data;
-
+	int64_t begin = input_event_begin(seat, CAGE_INPUT_POINTER, event->time_msec);
+	struct cg_record record = {
+		.type = CAGE_RECORD_POINTER_MOTION,
+		.time_msec = event->time_msec,
+		.x = event->delta_x,
+		.y = event->delta_y,
+		.ux = event->unaccel_dx,
+		.uy = event->unaccel_dy,
+	};
+	record_event(seat, &record);
+
+	seat_set_cursor_hidden(seat, false);
 	wlr_cursor_move(seat->cursor, &event->pointer->base, event->delta_x, event->delta_y);
-	process_cursor_motion(seat, event->time_msec, event->delta_x, event->delta_y, event->unaccel_dx,
-			      event->unaccel_dy);
-	wlr_idle_notifier_v1_notify_activity(seat->server->idle, seat->seat);
+	if (seat->server->coalesce_motion) {
+		seat_queue_pointer_motion(seat, event->time_msec, event->delta_x, event->delta_y, event->unaccel_dx,
+					  event->unaccel_dy);
+	} else {
+		process_cursor_motion(seat, event->time_msec, event->delta_x, event->delta_y, event->unaccel_dx,
+				      event->unaccel_dy);
+	}
+	input_event_end(seat, CAGE_INPUT_POINTER, begin);
+	seat_notify_activity(seat);
 }
 
 static void
@@ -736,6 +1461,7 @@ handle_drag_icon_destroy(struct wl_listener *listener, void *data)
 	wl_list_remove(&drag_icon->link);
 	wl_list_remove(&drag_icon->destroy.link);
 	wlr_scene_node_destroy(&drag_icon->scene_tree->node);
+	drag_icon->seat->server->hit_test_valid = false;
 	free(drag_icon);
 }
 
@@ -779,6 +1505,7 @@ handle_start_drag(struct wl_listener *listener, void *data)
 	drag_icon->seat = seat;
 	drag_icon->wlr_drag_icon = wlr_drag_icon;
 	drag_icon->scene_tree = wlr_scene_subsurface_tree_create(&seat->server->scene->tree, wlr_drag_icon->surface);
+	seat->server->hit_test_valid = false;
 	if (!drag_icon->scene_tree) {
 		free(drag_icon);
 		return;
@@ -802,6 +1529,15 @@ handle_destroy(struct wl_listener *listener, void *data)
 	wl_list_remove(&seat->cursor_button.link);
 	wl_list_remove(&seat->cursor_axis.link);
 	wl_list_remove(&seat->cursor_frame.link);
+	if (seat->motion_timer) {
+		wl_event_source_remove(seat->motion_timer);
+	}
+	if (seat->input_flush_idle) {
+		wl_event_source_remove(seat->input_flush_idle);
+	}
+	if (seat->activity_timer) {
+		wl_event_source_remove(seat->activity_timer);
+	}
 	wl_list_remove(&seat->touch_down.link);
 	wl_list_remove(&seat->touch_up.link);
 	wl_list_remove(&seat->touch_motion.link);
@@ -825,6 +1561,13 @@ handle_destroy(struct wl_listener *listener, void *data)
 	}
 	wl_list_remove(&seat->new_input.link);
 
+	struct cg_keymap *keymap, *keymap_tmp;
+	wl_list_for_each_safe (keymap, keymap_tmp, &seat->keymaps, link) {
+		keymap_destroy(keymap);
+	}
+	xkb_context_unref(seat->xkb_context);
+	xkb_keymap_unref(seat->file_keymap);
+
 	if (seat->cursor) {
 		wlr_cursor_destroy(seat->cursor);
 	}
@@ -870,6 +1613,19 @@ seat_create(struct cg_server *server, struct wlr_backend *backend)
 	seat->cursor_frame.notify = handle_cursor_frame;
 	wl_signal_add(&seat->cursor->events.frame, &seat->cursor_frame);
 
+	struct wl_event_loop *event_loop = wl_display_get_event_loop(server->wl_display);
+	seat->activity_timer = wl_event_loop_add_timer(event_loop, handle_activity_timer, seat);
+	if (!seat->activity_timer) {
+		wlr_log(WLR_ERROR, "Failed to create activity timer, not coalescing activity");
+	}
+
+	if (server->coalesce_motion) {
+		seat->motion_timer = wl_event_loop_add_timer(event_loop, handle_motion_timer, seat);
+		if (!seat->motion_timer) {
+			wlr_log(WLR_ERROR, "Failed to create motion timer, not coalescing pointer motion");
+		}
+	}
+
 	seat->touch_down.notify = handle_touch_down;
 	wl_signal_add(&seat->cursor->events.touch_down, &seat->touch_down);
 	seat->touch_up.notify = handle_touch_up;
@@ -888,6 +1644,7 @@ seat_create(struct cg_server *server, struct wlr_backend *backend)
 
 	wl_list_init(&seat->keyboards);
 	wl_list_init(&seat->keyboard_groups);
+	wl_list_init(&seat->keymaps);
 	wl_list_init(&seat->pointers);
 	wl_list_init(&seat->touch);
 
@@ -913,6 +1670,9 @@ seat_destroy(struct cg_seat *seat)
 		return;
 	}
 
+	record_finish(seat);
+	replay_finish(seat);
+
 	wl_list_remove(&seat->request_start_drag.link);
 	wl_list_remove(&seat->start_drag.link);
 
@@ -946,6 +1706,7 @@ seat_set_focus(struct cg_seat *seat, struct cg_view *view)
 	if (!view || prev_view == view) {
 		return;
 	}
+	CG_TRACE2(seat_set_focus, prev_view, view);
 
 #if CAGE_HAS_XWAYLAND
 	if (view->type == CAGE_XWAYLAND_VIEW) {
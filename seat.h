@@ -6,13 +6,55 @@
 #include <wlr/types/wlr_data_device.h>
 #include <wlr/types/wlr_input_device.h>
 #include <wlr/types/wlr_seat.h>
+#include <xkbcommon/xkbcommon.h>
 
 #include "server.h"
+#include "stats.h"
 #include "view.h"
 
 #define DEFAULT_XCURSOR "left_ptr"
 #define XCURSOR_SIZE 24
 
+enum cg_input_type {
+	CAGE_INPUT_KEYBOARD,
+	CAGE_INPUT_POINTER,
+	CAGE_INPUT_TOUCH,
+	CAGE_INPUT_TYPE_COUNT,
+};
+
+#define CG_INPUT_PENDING_MAX 64
+
+/* Time spent by input events in Cage, see input_event_begin. */
+struct cg_input_latency {
+	/* From the listener being called to the seat having notified the client. */
+	struct cg_histogram dispatch;
+	/* From the listener being called to the end of the event loop
+	 * iteration, after which the events are flushed to the clients. */
+	struct cg_histogram flush;
+	/* From the event's timestamp to the listener being called. */
+	struct cg_histogram skew;
+	/* Listener call times of events not flushed yet. */
+	int64_t pending[CG_INPUT_PENDING_MAX];
+	int pending_count;
+};
+
+#define CG_TOUCH_RESAMPLE_POINTS 10
+
+struct cg_touch_sample {
+	int64_t time_nsec;
+	double lx, ly;
+};
+
+/* The most recent samples of a touch point, see seat_resample_touch. */
+struct cg_touch_track {
+	bool active;
+	bool pending;
+	int32_t touch_id;
+	struct cg_touch_sample samples[2]; // latest last
+	int sample_count;
+	int64_t sent_nsec;
+};
+
 struct cg_seat {
 	struct wlr_seat *seat;
 	struct cg_server *server;
@@ -20,16 +62,38 @@ struct cg_seat {
 
 	struct wl_list keyboards;
 	struct wl_list keyboard_groups;
+	/* Compiled keymaps shared by all keyboards, see seat_get_keymap. */
+	struct xkb_context *xkb_context;
+	struct wl_list keymaps; // cg_keymap::link
+	/* Loaded from cg_server::keymap_file, if given. */
+	struct xkb_keymap *file_keymap;
+	bool file_keymap_failed;
+	uint64_t keymap_compiles;
 	struct wl_list pointers;
 	struct wl_list touch;
 	struct wl_listener new_input;
+	/* See record.c. */
+	struct cg_recorder *recorder;
+	struct cg_replay *replay;
 
 	struct wlr_cursor *cursor;
+	/* In scanout mode, the cursor is hidden while using touch. */
+	bool cursor_hidden;
 	struct wl_listener cursor_motion_relative;
 	struct wl_listener cursor_motion_absolute;
 	struct wl_listener cursor_button;
 	struct wl_listener cursor_axis;
 	struct wl_listener cursor_frame;
+	/* With motion coalescing, the surface under the cursor is looked up
+	 * and sent the new position at most once per output refresh. */
+	bool motion_pending;
+	/* Relative motion is sent right away and needs its own frame. */
+	bool relative_motion_unframed;
+	uint32_t motion_time_msec;
+	int64_t motion_flushed_nsec;
+	struct wl_event_source *motion_timer;
+	uint64_t motion_events;
+	uint64_t motion_flushes;
 
 	int32_t touch_id;
 	double touch_lx;
@@ -38,6 +102,18 @@ struct cg_seat {
 	struct wl_listener touch_up;
 	struct wl_listener touch_motion;
 	struct wl_listener touch_frame;
+	/* With touch resampling, motion is sent once per output frame. */
+	struct cg_touch_track touch_tracks[CG_TOUCH_RESAMPLE_POINTS];
+	bool touch_motion_pending;
+	/* Whether the current touch frame has a point going down or up. */
+	bool touch_frame_contact;
+
+	struct cg_input_latency input_latency[CAGE_INPUT_TYPE_COUNT];
+	/* Coalesced idle-notify activity, see seat_notify_activity. */
+	bool activity_pending;
+	int64_t activity_notified_nsec;
+	struct wl_event_source *activity_timer;
+	struct wl_event_source *input_flush_idle;
 
 	struct wl_list drag_icons;
 	struct wl_listener request_start_drag;
@@ -48,6 +124,12 @@ struct cg_seat {
 	struct wl_listener request_set_primary_selection;
 };
 
+struct cg_keymap {
+	struct wl_list link; // cg_seat::keymaps
+	struct xkb_rule_names names;
+	struct xkb_keymap *keymap;
+};
+
 struct cg_keyboard_group {
 	struct wlr_keyboard_group *wlr_group;
 	struct cg_seat *seat;
@@ -90,6 +172,9 @@ void seat_destroy(struct cg_seat *seat);
 struct cg_view *seat_get_focus(struct cg_seat *seat);
 void seat_set_focus(struct cg_seat *seat, struct cg_view *view);
 void seat_center_cursor(struct cg_seat *seat);
+void seat_log_stats(struct cg_seat *seat);
+void seat_resample_touch(struct cg_seat *seat, int64_t frame_nsec);
+void seat_add_device(struct cg_seat *seat, struct wlr_input_device *device);
 
 void handle_request_set_shape(struct wl_listener *listener, void *data);
 #endif
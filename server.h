@@ -3,6 +3,8 @@
 
 #include "config.h"
 
+#include <stdbool.h>
+#include <sys/types.h>
 #include <wayland-server-core.h>
 #include <wlr/config.h>
 #include <wlr/types/wlr_drm_lease_v1.h>
@@ -17,14 +19,70 @@
 #include <wlr/xwayland.h>
 #endif
 
+#include "stats.h"
+
 enum cg_multi_output_mode {
 	CAGE_MULTI_OUTPUT_MODE_EXTEND,
 	CAGE_MULTI_OUTPUT_MODE_LAST,
+	CAGE_MULTI_OUTPUT_MODE_MIRROR,
+};
+
+enum cg_mode_policy {
+	CAGE_MODE_POLICY_PREFERRED,
+	/* Highest or lowest refresh rate at the native resolution. */
+	CAGE_MODE_POLICY_HIGHEST_REFRESH,
+	CAGE_MODE_POLICY_LOWEST_POWER,
+	/* Largest mode within width x height @ refresh. */
+	CAGE_MODE_POLICY_MAX,
+	/* Exactly width x height, closest to refresh. */
+	CAGE_MODE_POLICY_EXACT,
+};
+
+/* How to pick the mode of an output, globally or for one connector. */
+struct cg_mode_rule {
+	struct wl_list link; // cg_server::mode_rules
+	char *output_name;
+	const char *spec;
+	enum cg_mode_policy policy;
+	int32_t width, height;
+	int32_t refresh; // mHz, 0 if unspecified
+};
+
+/* An application launched by Cage. Cage exits when any of them does. */
+struct cg_app {
+	struct cg_server *server;
+	struct wl_list link; // cg_server::apps
+	char **argv;
+	pid_t pid;
+	struct wl_event_source *sigchld_source;
+
+	/* Pinned applications are shown on an output of their own. */
+	bool pinned;
+	struct cg_output *output;
+
+	/* Set while the application is terminated to be started again. */
+	bool restarting;
 };
 
 struct cg_server {
 	struct wl_display *wl_display;
+	struct wl_list apps; // cg_app::link
+	struct cg_app *exited_app;
 	struct wl_list views;
+	struct wl_event_source *occlusion_idle;
+	/* The topmost enabled node of the scene if it is a view, for
+	 * desktop_view_at. Reset whenever the stacking changes. */
+	struct cg_view *hit_test_view;
+	bool hit_test_valid;
+	uint64_t views_occluded;
+	/* View churn; map, unmap and destroy are timed from start to end,
+	 * as are the handlers of new popups and decorations. */
+	struct cg_histogram view_map_time;
+	struct cg_histogram view_unmap_time;
+	struct cg_histogram view_destroy_time;
+	struct cg_histogram popup_create_time;
+	struct cg_histogram decoration_create_time;
+	uint64_t views_destroyed;
 	struct wlr_backend *backend;
 	struct wlr_renderer *renderer;
 	struct wlr_allocator *allocator;
@@ -32,6 +90,8 @@ struct cg_server {
 	struct wl_listener display_destroy;
 
 	struct cg_seat *seat;
+	struct cg_ipc *ipc;
+	struct cg_metrics *metrics;
 	struct wlr_idle_notifier_v1 *idle;
 	struct wlr_idle_inhibit_manager_v1 *idle_inhibit_v1;
 	struct wl_listener new_idle_inhibitor_v1;
@@ -47,6 +107,25 @@ struct cg_server {
 	struct wl_list outputs; // cg_output::link
 	struct wl_listener new_output;
 	struct wl_listener output_layout_change;
+	struct cg_mode_rule mode_policy;
+	struct wl_list mode_rules; // cg_mode_rule::link
+	/* Deferred work after output and layout changes, see
+	 * schedule_layout_update. */
+	struct wl_event_source *layout_update_idle;
+	bool pending_view_position;
+	bool pending_output_config;
+
+	/* Hotplug debouncing: layout changes are held back until no output
+	 * has been connected or disconnected for hotplug_debounce msec. */
+	int hotplug_debounce;
+	struct wl_event_source *hotplug_timer;
+	bool hotplug_settling;
+	/* Set for the layout update that ends the debounce window. */
+	bool hotplug_flush;
+	struct wlr_box hotplug_layout_box;
+	uint64_t hotplugs;
+	/* Bumped for every frame the mirror source commits. */
+	uint64_t mirror_seq;
 
 	struct wl_listener xdg_toplevel_decoration;
 	struct wl_listener new_xdg_toplevel;
@@ -76,13 +155,27 @@ struct cg_server {
 	struct wl_listener cursor_shape_manager_set_shape;
 
 	bool xdg_decoration;
+	bool scanout_mode;
 	bool allow_vt_switch;
 	bool enable_xwayland;
-	bool return_app_code;
+	bool enable_ipc;
+	bool app_per_output;
+	bool coalesce_motion;
+	bool touch_resample;
+	const char *keymap_file;
+	const char *metrics_path;
+	const char *record_path;
+	const char *replay_path;
 	bool terminated;
+	/* Render deadline in milliseconds before vblank; 0 disables it. */
+	int max_render_time;
+	bool auto_render_time;
 	enum wlr_log_importance log_level;
 };
 
 void server_terminate(struct cg_server *server);
+struct cg_app *server_app_from_pid(struct cg_server *server, pid_t pid);
+bool server_restart_app(struct cg_server *server);
+void server_log_stats(struct cg_server *server);
 
 #endif
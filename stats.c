@@ -0,0 +1,101 @@
+/*
+ * Cage: A Wayland kiosk.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+#include <wlr/util/log.h>
+
+#include "stats.h"
+
+int64_t
+timespec_to_nsec(const struct timespec *ts)
+{
+	return (int64_t) ts->tv_sec * 1000000000 + ts->tv_nsec;
+}
+
+void
+histogram_add(struct cg_histogram *histogram, int64_t nsec)
+{
+	uint64_t usec = nsec > 0 ? (uint64_t) nsec / 1000 : 0;
+
+	int bucket = 0;
+	if (usec > 0) {
+		bucket = 64 - __builtin_clzll(usec);
+		if (bucket >= CG_HISTOGRAM_BUCKETS) {
+			bucket = CG_HISTOGRAM_BUCKETS - 1;
+		}
+	}
+
+	histogram->buckets[bucket]++;
+	histogram->count++;
+	histogram->sum_usec += usec;
+	if (usec > histogram->max_usec) {
+		histogram->max_usec = usec;
+	}
+}
+
+/* Returns the upper bound, in µs, of the bucket containing the given
+ * percentile (between 0 and 1). */
+uint64_t
+histogram_percentile(const struct cg_histogram *histogram, double percentile)
+{
+	if (histogram->count == 0) {
+		return 0;
+	}
+
+	uint64_t rank = (uint64_t) (percentile * (double) histogram->count);
+	uint64_t seen = 0;
+	for (int i = 0; i < CG_HISTOGRAM_BUCKETS; i++) {
+		seen += histogram->buckets[i];
+		if (seen > rank) {
+			return i == 0 ? 1 : (uint64_t) 1 << i;
+		}
+	}
+
+	return histogram->max_usec;
+}
+
+void
+histogram_log(const struct cg_histogram *histogram, const char *prefix, const char *name)
+{
+	if (histogram->count == 0) {
+		wlr_log(WLR_INFO, "%s %s: no samples", prefix, name);
+		return;
+	}
+
+	wlr_log(WLR_INFO,
+		"%s %s: %" PRIu64 " samples, avg %.3f ms, p50 < %.3f ms, p99 < %.3f ms, max %.3f ms", prefix, name,
+		histogram->count, (double) histogram->sum_usec / (double) histogram->count / 1000.0,
+		(double) histogram_percentile(histogram, 0.5) / 1000.0,
+		(double) histogram_percentile(histogram, 0.99) / 1000.0, (double) histogram->max_usec / 1000.0);
+}
+
+/* Returns the resident set size of Cage in bytes, or 0 if unknown. */
+uint64_t
+resident_memory_bytes(void)
+{
+	/* The second field is the resident set size, in pages. */
+	FILE *file = fopen("/proc/self/statm", "r");
+	if (!file) {
+		return 0;
+	}
+
+	unsigned long size, resident = 0;
+	if (fscanf(file, "%lu %lu", &size, &resident) != 2) {
+		resident = 0;
+	}
+	fclose(file);
+
+	long page_size = sysconf(_SC_PAGESIZE);
+	return (uint64_t) resident * (page_size > 0 ? page_size : 4096);
+}
@@ -0,0 +1,26 @@
+#ifndef CG_STATS_H
+#define CG_STATS_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define CG_HISTOGRAM_BUCKETS 32
+
+/* A fixed-size latency histogram with power-of-two microsecond buckets:
+ * bucket 0 counts samples below 1 µs, bucket i samples in [2^(i-1), 2^i) µs.
+ * Recording never allocates and all accesses happen on the event loop,
+ * so no locking is needed. */
+struct cg_histogram {
+	uint64_t buckets[CG_HISTOGRAM_BUCKETS];
+	uint64_t count;
+	uint64_t sum_usec;
+	uint64_t max_usec;
+};
+
+int64_t timespec_to_nsec(const struct timespec *ts);
+void histogram_add(struct cg_histogram *histogram, int64_t nsec);
+uint64_t histogram_percentile(const struct cg_histogram *histogram, double percentile);
+void histogram_log(const struct cg_histogram *histogram, const char *prefix, const char *name);
+uint64_t resident_memory_bytes(void);
+
+#endif
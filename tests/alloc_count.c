@@ -0,0 +1,157 @@
+/*
+ * Cage: A Wayland kiosk.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+/* Counts the allocations of the process it is preloaded into, for the soak
+ * test. The counters are kept in the file named by CAGE_ALLOC_COUNT_FILE,
+ * mapped shared, so that they can be read while the process runs. glibc
+ * only: the allocator is reached through its __libc_ entry points.
+ *
+ * LD_PRELOAD is removed from the environment once loaded, so that the
+ * processes Cage starts aren't counted as well. */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+extern void *__libc_malloc(size_t size);
+extern void *__libc_calloc(size_t nmemb, size_t size);
+extern void *__libc_realloc(void *ptr, size_t size);
+extern void *__libc_memalign(size_t alignment, size_t size);
+extern void __libc_free(void *ptr);
+
+/* The layout of the file, read by tests/soak.py. */
+struct alloc_counters {
+	uint64_t allocs;
+	uint64_t frees;
+};
+
+static struct alloc_counters early_counters;
+static struct alloc_counters *counters = &early_counters;
+
+static void
+count_alloc(void *ptr)
+{
+	if (ptr) {
+		__atomic_fetch_add(&counters->allocs, 1, __ATOMIC_RELAXED);
+	}
+}
+
+static void
+count_free(void *ptr)
+{
+	if (ptr) {
+		__atomic_fetch_add(&counters->frees, 1, __ATOMIC_RELAXED);
+	}
+}
+
+__attribute__((constructor)) static void
+alloc_count_init(void)
+{
+	unsetenv("LD_PRELOAD");
+
+	const char *path = getenv("CAGE_ALLOC_COUNT_FILE");
+	if (!path) {
+		return;
+	}
+	int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+	if (fd < 0) {
+		return;
+	}
+	if (ftruncate(fd, sizeof(struct alloc_counters)) == 0) {
+		void *map = mmap(NULL, sizeof(struct alloc_counters), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (map != MAP_FAILED) {
+			struct alloc_counters *file_counters = map;
+			*file_counters = early_counters;
+			counters = file_counters;
+		}
+	}
+	close(fd);
+}
+
+void *
+malloc(size_t size)
+{
+	void *ptr = __libc_malloc(size);
+	count_alloc(ptr);
+	return ptr;
+}
+
+void *
+calloc(size_t nmemb, size_t size)
+{
+	void *ptr = __libc_calloc(nmemb, size);
+	count_alloc(ptr);
+	return ptr;
+}
+
+void *
+realloc(void *ptr, size_t size)
+{
+	void *new_ptr = __libc_realloc(ptr, size);
+	if (!ptr) {
+		count_alloc(new_ptr);
+	} else if (size == 0 && !new_ptr) {
+		/* glibc frees the block. */
+		count_free(ptr);
+	}
+	return new_ptr;
+}
+
+void *
+memalign(size_t alignment, size_t size)
+{
+	void *ptr = __libc_memalign(alignment, size);
+	count_alloc(ptr);
+	return ptr;
+}
+
+void *
+aligned_alloc(size_t alignment, size_t size)
+{
+	return memalign(alignment, size);
+}
+
+int
+posix_memalign(void **memptr, size_t alignment, size_t size)
+{
+	if (alignment % sizeof(void *) != 0 || (alignment & (alignment - 1)) != 0) {
+		return EINVAL;
+	}
+	void *ptr = memalign(alignment, size);
+	if (!ptr) {
+		return ENOMEM;
+	}
+	*memptr = ptr;
+	return 0;
+}
+
+void *
+valloc(size_t size)
+{
+	return memalign(sysconf(_SC_PAGESIZE), size);
+}
+
+void *
+pvalloc(size_t size)
+{
+	size_t page_size = sysconf(_SC_PAGESIZE);
+	return memalign(page_size, (size + page_size - 1) & ~(page_size - 1));
+}
+
+void
+free(void *ptr)
+{
+	count_free(ptr);
+	__libc_free(ptr);
+}
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+"""Runs Cage on the headless backend with the pixman renderer, once per
+workload of the test client, and reports the frame rate, the commit
+latency and Cage's CPU time per frame, as read from the IPC socket and
+/proc. The workloads are damage-heavy shm clients redrawing all of their
+surface or a small part of it, a client with 16 subsurfaces and a client
+that opens a new popup every frame.
+
+The headless output runs at 1000 Hz so that the frame rate is bound by
+Cage and the client rather than by the refresh rate."""
+
+import argparse
+import time
+
+import harness
+
+OUTPUT = "HEADLESS-1"
+MODE = "1920x1080@1000"
+REFRESH_MHZ = 1000000
+
+WORKLOADS = [
+    ("shm-full", ["-m", "frames"]),
+    ("shm-damage", ["-m", "damage"]),
+    ("subsurfaces", ["-m", "subsurfaces", "-n", "16"]),
+    ("popups", ["-m", "popups"]),
+]
+
+
+def run(args, name, client_args):
+    with harness.Cage(args.cage, ["-M", "{}={}".format(OUTPUT, MODE)], [args.client] + client_args) as cage:
+        outputs = cage.query("outputs")
+        if not any(line.startswith("output {} ".format(OUTPUT)) and "@{} ".format(REFRESH_MHZ) in line
+                   for line in outputs):
+            harness.fail("{}: {} isn't running at {}: {}".format(name, OUTPUT, MODE, outputs))
+
+        # Let the client start up before measuring.
+        time.sleep(1)
+        before = cage.histograms()["output " + OUTPUT]
+        cpu_before = cage.cpu_seconds()
+        time.sleep(args.duration)
+        after = cage.histograms()["output " + OUTPUT]
+        cpu_after = cage.cpu_seconds()
+
+    frames = int(after["committed"]) - int(before["committed"])
+    if frames == 0:
+        harness.fail("{}: no frames were committed".format(name))
+    # Of the frames committed while measuring only.
+    commit_p50 = harness.delta_percentile(before["commit"], after["commit"], 0.5)
+    commit_p99 = harness.delta_percentile(before["commit"], after["commit"], 0.99)
+    cpu_ms = (cpu_after - cpu_before) * 1000 / frames
+    print("{:<16} {:>8.1f} {:>10} {:>10} {:>12.3f}".format(name, frames / args.duration, commit_p50, commit_p99,
+                                                            cpu_ms))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("cage", help="the Cage executable")
+    parser.add_argument("client", help="the cage-test-client executable")
+    parser.add_argument("-d", "--duration", type=float, default=10, help="seconds to measure each workload")
+    args = parser.parse_args()
+
+    print("{:<16} {:>8} {:>10} {:>10} {:>12}".format("client", "frames/s", "commit p50", "commit p99",
+                                                     "cpu ms/frame"))
+    for name, client_args in WORKLOADS:
+        run(args, name, client_args)
+
+
+if __name__ == "__main__":
+    main()
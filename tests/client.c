@@ -0,0 +1,1031 @@
+/*
+ * Cage: A Wayland kiosk.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+/* A client for the benchmark and the soak test. It either draws a new
+ * frame into wl_shm buffers as soon as the compositor asks for one, with
+ * subsurfaces or a popup if asked to, or keeps opening and closing
+ * dialogs, popups and, with XWayland, X11 windows next to its main
+ * window. With -l, it logs how long pointer and touch events took to
+ * reach it. */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <errno.h>
+#include <inttypes.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <time.h>
+#include <unistd.h>
+#include <wayland-client.h>
+
+#if CAGE_TEST_HAS_XCB
+#include <xcb/xcb.h>
+#endif
+
+#include "xdg-decoration-unstable-v1-client-protocol.h"
+#include "xdg-shell-client-protocol.h"
+
+#define BUFFER_COUNT 3
+#define DEFAULT_WIDTH 640
+#define DEFAULT_HEIGHT 480
+#define DAMAGE_SIZE 64
+#define POPUP_WIDTH 128
+#define POPUP_HEIGHT 96
+#define SUBSURFACE_SIZE 96
+#define SUBSURFACE_COUNT 8
+#define MAX_SUBSURFACES 64
+#define CHURN_INTERVAL 20
+
+enum cg_test_mode {
+	/* Redraw and damage the whole surface every frame. */
+	CG_TEST_FRAMES,
+	/* Redraw and damage a small square every frame. */
+	CG_TEST_DAMAGE,
+	/* Redraw and damage the whole surface and all subsurfaces every
+	 * frame. */
+	CG_TEST_SUBSURFACES,
+	/* Redraw a small square and open a new popup every frame. */
+	CG_TEST_POPUPS,
+	/* Open and close other windows next to the main one. */
+	CG_TEST_CHURN,
+};
+
+#if CAGE_TEST_HAS_XCB
+enum cg_test_x11_window {
+	CG_TEST_X11_MAIN,
+	/* Transient for the main window. */
+	CG_TEST_X11_DIALOG,
+	/* Override-redirect, like a menu. */
+	CG_TEST_X11_MENU,
+	CG_TEST_X11_WINDOW_COUNT,
+};
+#endif
+
+struct cg_test_buffer {
+	struct wl_buffer *wl_buffer;
+	uint32_t *data;
+	size_t size;
+	bool busy;
+};
+
+struct cg_test_subsurface {
+	struct wl_surface *surface;
+	struct wl_subsurface *subsurface;
+	struct cg_test_buffer buffers[BUFFER_COUNT];
+};
+
+struct cg_test_window {
+	struct cg_test_client *client;
+	struct wl_surface *surface;
+	struct xdg_surface *xdg_surface;
+	struct xdg_toplevel *xdg_toplevel; // NULL for popups
+	struct xdg_popup *xdg_popup;
+	struct zxdg_toplevel_decoration_v1 *decoration;
+	struct wl_callback *frame_callback;
+	struct cg_test_buffer buffers[BUFFER_COUNT];
+	int32_t width, height;
+	int32_t pending_width, pending_height;
+	uint32_t frame;
+	struct cg_test_subsurface subsurfaces[MAX_SUBSURFACES];
+	int subsurface_count;
+};
+
+struct cg_test_client {
+	enum cg_test_mode mode;
+	struct wl_display *display;
+	struct wl_registry *registry;
+	struct wl_compositor *compositor;
+	struct wl_subcompositor *subcompositor;
+	struct wl_shm *shm;
+	struct xdg_wm_base *wm_base;
+	struct zxdg_decoration_manager_v1 *decoration_manager;
+	struct cg_test_window *window;
+	int subsurface_count;
+
+	/* The latency of each pointer and touch event, from the time it
+	 * carries to its arrival, is written to latency_log. */
+	FILE *latency_log;
+	struct wl_seat *seat;
+	struct wl_pointer *pointer;
+	struct wl_touch *touch;
+
+	/* In churn mode, the windows that are opened in one step and closed
+	 * in the next. The popup is also the one of popups mode. */
+	int churn_interval; // msec
+	int64_t next_step;  // msec, CLOCK_MONOTONIC
+	struct cg_test_window *dialog;
+	struct cg_test_window *popup;
+#if CAGE_TEST_HAS_XCB
+	xcb_connection_t *xcb;
+	xcb_screen_t *x11_screen;
+	xcb_window_t x11_windows[CG_TEST_X11_WINDOW_COUNT];
+	bool x11_mapped;
+#endif
+
+	bool use_x11;
+	bool running;
+};
+
+static int64_t
+now_msec(void)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (int64_t) now.tv_sec * 1000 + now.tv_nsec / 1000000;
+}
+
+static void
+buffer_finish(struct cg_test_buffer *buffer)
+{
+	if (buffer->wl_buffer) {
+		wl_buffer_destroy(buffer->wl_buffer);
+		munmap(buffer->data, buffer->size);
+	}
+	*buffer = (struct cg_test_buffer){0};
+}
+
+static void
+handle_buffer_release(void *data, struct wl_buffer *wl_buffer)
+{
+	struct cg_test_buffer *buffer = data;
+	buffer->busy = false;
+}
+
+static const struct wl_buffer_listener buffer_listener = {
+	.release = handle_buffer_release,
+};
+
+/* Returns an unlinked file of size bytes in XDG_RUNTIME_DIR. */
+static int
+create_shm_file(size_t size)
+{
+	const char *runtime_dir = getenv("XDG_RUNTIME_DIR");
+	if (!runtime_dir) {
+		fprintf(stderr, "XDG_RUNTIME_DIR is not set\n");
+		return -1;
+	}
+
+	char path[4096];
+	if (snprintf(path, sizeof(path), "%s/cage-test-client-XXXXXX", runtime_dir) >= (int) sizeof(path)) {
+		return -1;
+	}
+	int fd = mkstemp(path);
+	if (fd < 0) {
+		perror("mkstemp");
+		return -1;
+	}
+	unlink(path);
+
+	int ret;
+	do {
+		ret = ftruncate(fd, (off_t) size);
+	} while (ret < 0 && errno == EINTR);
+	if (ret < 0) {
+		perror("ftruncate");
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+static bool
+buffer_init(struct cg_test_buffer *buffer, struct wl_shm *shm, int32_t width, int32_t height)
+{
+	int32_t stride = width * 4;
+	size_t size = (size_t) stride * (size_t) height;
+
+	int fd = create_shm_file(size);
+	if (fd < 0) {
+		return false;
+	}
+	void *data = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	if (data == MAP_FAILED) {
+		perror("mmap");
+		close(fd);
+		return false;
+	}
+
+	struct wl_shm_pool *pool = wl_shm_create_pool(shm, fd, (int32_t) size);
+	buffer->wl_buffer = wl_shm_pool_create_buffer(pool, 0, width, height, stride, WL_SHM_FORMAT_XRGB8888);
+	wl_shm_pool_destroy(pool);
+	close(fd);
+
+	buffer->data = data;
+	buffer->size = size;
+	buffer->busy = false;
+	wl_buffer_add_listener(buffer->wl_buffer, &buffer_listener, buffer);
+	return true;
+}
+
+static struct cg_test_buffer *
+next_buffer(struct cg_test_buffer *buffers, struct wl_shm *shm, int32_t width, int32_t height)
+{
+	for (int i = 0; i < BUFFER_COUNT; i++) {
+		struct cg_test_buffer *buffer = &buffers[i];
+		if (buffer->busy) {
+			continue;
+		}
+		if (!buffer->wl_buffer && !buffer_init(buffer, shm, width, height)) {
+			return NULL;
+		}
+		return buffer;
+	}
+	return NULL;
+}
+
+/* Paints the whole buffer or only a square that moves one step along the
+ * diagonal every frame, and damages what was painted. */
+static void
+paint(struct wl_surface *surface, struct cg_test_buffer *buffer, int32_t width, int32_t height, uint32_t frame,
+      bool full)
+{
+	uint32_t color = 0xff000000 | (frame * 0x010203);
+
+	if (full) {
+		for (size_t i = 0; i < (size_t) width * (size_t) height; i++) {
+			buffer->data[i] = color ^ (uint32_t) i;
+		}
+		wl_surface_damage_buffer(surface, 0, 0, width, height);
+		return;
+	}
+
+	int32_t size = DAMAGE_SIZE < width && DAMAGE_SIZE < height ? DAMAGE_SIZE : 1;
+	int32_t x = (int32_t) (frame % (uint32_t) (width - size + 1));
+	int32_t y = (int32_t) (frame % (uint32_t) (height - size + 1));
+	for (int32_t row = y; row < y + size; row++) {
+		for (int32_t col = x; col < x + size; col++) {
+			buffer->data[(size_t) row * (size_t) width + (size_t) col] = color;
+		}
+	}
+	wl_surface_damage_buffer(surface, x, y, size, size);
+}
+
+/* Subsurfaces are synchronized, so what they commit is shown with the
+ * next commit of the window. */
+static void
+subsurface_draw(struct cg_test_subsurface *subsurface, struct wl_shm *shm, uint32_t frame)
+{
+	struct cg_test_buffer *buffer = next_buffer(subsurface->buffers, shm, SUBSURFACE_SIZE, SUBSURFACE_SIZE);
+	if (!buffer) {
+		return;
+	}
+	paint(subsurface->surface, buffer, SUBSURFACE_SIZE, SUBSURFACE_SIZE, frame, true);
+	wl_surface_attach(subsurface->surface, buffer->wl_buffer, 0, 0);
+	buffer->busy = true;
+	wl_surface_commit(subsurface->surface);
+}
+
+static struct cg_test_window *window_create(struct cg_test_client *client, struct cg_test_window *parent,
+					    bool popup);
+static void window_destroy(struct cg_test_window *window);
+
+/* Replaces the popup of the main window once it has been drawn. */
+static void
+popup_cycle(struct cg_test_client *client)
+{
+	if (client->popup && client->popup->frame == 0) {
+		return;
+	}
+	if (client->popup) {
+		window_destroy(client->popup);
+	}
+	client->popup = window_create(client, client->window, true);
+}
+
+static void window_draw(struct cg_test_window *window);
+
+static void
+handle_frame_done(void *data, struct wl_callback *callback, uint32_t time)
+{
+	struct cg_test_window *window = data;
+	wl_callback_destroy(callback);
+	window->frame_callback = NULL;
+	window_draw(window);
+}
+
+static const struct wl_callback_listener frame_listener = {
+	.done = handle_frame_done,
+};
+
+/* Draws a frame if a buffer is free. Unless churning, it asks for the next
+ * frame either way, so that a client waiting for a release keeps the frame
+ * loop going. */
+static void
+window_draw(struct cg_test_window *window)
+{
+	struct cg_test_client *client = window->client;
+	bool main_window = window == client->window;
+
+	for (int i = 0; i < window->subsurface_count; i++) {
+		subsurface_draw(&window->subsurfaces[i], client->shm, window->frame);
+	}
+	if (main_window && client->mode == CG_TEST_POPUPS && window->frame > 0) {
+		popup_cycle(client);
+	}
+
+	struct cg_test_buffer *buffer = next_buffer(window->buffers, client->shm, window->width, window->height);
+	if (buffer) {
+		bool full = !main_window || (client->mode != CG_TEST_DAMAGE && client->mode != CG_TEST_POPUPS);
+		paint(window->surface, buffer, window->width, window->height, window->frame, full);
+		wl_surface_attach(window->surface, buffer->wl_buffer, 0, 0);
+		buffer->busy = true;
+		window->frame++;
+	}
+
+	if (main_window && client->mode != CG_TEST_CHURN) {
+		window->frame_callback = wl_surface_frame(window->surface);
+		wl_callback_add_listener(window->frame_callback, &frame_listener, window);
+	}
+	wl_surface_commit(window->surface);
+}
+
+static void
+handle_xdg_surface_configure(void *data, struct xdg_surface *xdg_surface, uint32_t serial)
+{
+	struct cg_test_window *window = data;
+	xdg_surface_ack_configure(xdg_surface, serial);
+
+	int32_t width = window->pending_width > 0 ? window->pending_width : DEFAULT_WIDTH;
+	int32_t height = window->pending_height > 0 ? window->pending_height : DEFAULT_HEIGHT;
+	if (width != window->width || height != window->height) {
+		for (int i = 0; i < BUFFER_COUNT; i++) {
+			buffer_finish(&window->buffers[i]);
+		}
+		window->width = width;
+		window->height = height;
+	}
+
+	if (!window->frame_callback) {
+		window_draw(window);
+	}
+}
+
+static const struct xdg_surface_listener xdg_surface_listener = {
+	.configure = handle_xdg_surface_configure,
+};
+
+static void
+handle_xdg_toplevel_configure(void *data, struct xdg_toplevel *xdg_toplevel, int32_t width, int32_t height,
+			      struct wl_array *states)
+{
+	struct cg_test_window *window = data;
+	window->pending_width = width;
+	window->pending_height = height;
+}
+
+static void
+handle_xdg_toplevel_close(void *data, struct xdg_toplevel *xdg_toplevel)
+{
+	struct cg_test_window *window = data;
+	if (window == window->client->window) {
+		window->client->running = false;
+	}
+}
+
+static const struct xdg_toplevel_listener xdg_toplevel_listener = {
+	.configure = handle_xdg_toplevel_configure,
+	.close = handle_xdg_toplevel_close,
+};
+
+static void
+handle_xdg_popup_configure(void *data, struct xdg_popup *xdg_popup, int32_t x, int32_t y, int32_t width,
+			   int32_t height)
+{
+	struct cg_test_window *window = data;
+	window->pending_width = width;
+	window->pending_height = height;
+}
+
+static void
+handle_xdg_popup_done(void *data, struct xdg_popup *xdg_popup)
+{
+	/* No-op, the popup is destroyed with the next step. */
+}
+
+static const struct xdg_popup_listener xdg_popup_listener = {
+	.configure = handle_xdg_popup_configure,
+	.popup_done = handle_xdg_popup_done,
+};
+
+static void
+handle_decoration_configure(void *data, struct zxdg_toplevel_decoration_v1 *decoration, uint32_t mode)
+{
+	/* No-op */
+}
+
+static const struct zxdg_toplevel_decoration_v1_listener decoration_listener = {
+	.configure = handle_decoration_configure,
+};
+
+/* Creates a toplevel, a child of parent if there is one, or a popup of
+ * parent. */
+static struct cg_test_window *
+window_create(struct cg_test_client *client, struct cg_test_window *parent, bool popup)
+{
+	struct cg_test_window *window = calloc(1, sizeof(*window));
+	if (!window) {
+		return NULL;
+	}
+	window->client = client;
+	window->surface = wl_compositor_create_surface(client->compositor);
+	window->xdg_surface = xdg_wm_base_get_xdg_surface(client->wm_base, window->surface);
+	xdg_surface_add_listener(window->xdg_surface, &xdg_surface_listener, window);
+
+	if (popup) {
+		struct xdg_positioner *positioner = xdg_wm_base_create_positioner(client->wm_base);
+		xdg_positioner_set_size(positioner, POPUP_WIDTH, POPUP_HEIGHT);
+		xdg_positioner_set_anchor_rect(positioner, 0, 0, 1, 1);
+		window->xdg_popup = xdg_surface_get_popup(window->xdg_surface, parent->xdg_surface, positioner);
+		xdg_positioner_destroy(positioner);
+		xdg_popup_add_listener(window->xdg_popup, &xdg_popup_listener, window);
+	} else {
+		window->xdg_toplevel = xdg_surface_get_toplevel(window->xdg_surface);
+		xdg_toplevel_add_listener(window->xdg_toplevel, &xdg_toplevel_listener, window);
+		if (parent) {
+			xdg_toplevel_set_parent(window->xdg_toplevel, parent->xdg_toplevel);
+		}
+		xdg_toplevel_set_title(window->xdg_toplevel, parent ? "cage-test-client dialog" : "cage-test-client");
+		xdg_toplevel_set_app_id(window->xdg_toplevel, "cage-test-client");
+		if (client->decoration_manager) {
+			window->decoration = zxdg_decoration_manager_v1_get_toplevel_decoration(
+				client->decoration_manager, window->xdg_toplevel);
+			zxdg_toplevel_decoration_v1_add_listener(window->decoration, &decoration_listener, window);
+			zxdg_toplevel_decoration_v1_set_mode(window->decoration,
+							     ZXDG_TOPLEVEL_DECORATION_V1_MODE_SERVER_SIDE);
+		}
+	}
+
+	wl_surface_commit(window->surface);
+	return window;
+}
+
+/* Lays count subsurfaces out in rows over the window. */
+static void
+window_add_subsurfaces(struct cg_test_window *window, int count)
+{
+	struct cg_test_client *client = window->client;
+	for (int i = 0; i < count; i++) {
+		struct cg_test_subsurface *subsurface = &window->subsurfaces[i];
+		subsurface->surface = wl_compositor_create_surface(client->compositor);
+		subsurface->subsurface =
+			wl_subcompositor_get_subsurface(client->subcompositor, subsurface->surface, window->surface);
+		wl_subsurface_set_position(subsurface->subsurface, 16 + (i % 8) * (SUBSURFACE_SIZE + 16),
+					   16 + (i / 8) * (SUBSURFACE_SIZE + 16));
+	}
+	window->subsurface_count = count;
+}
+
+static void
+window_destroy(struct cg_test_window *window)
+{
+	if (window->frame_callback) {
+		wl_callback_destroy(window->frame_callback);
+	}
+	for (int i = 0; i < window->subsurface_count; i++) {
+		struct cg_test_subsurface *subsurface = &window->subsurfaces[i];
+		for (int j = 0; j < BUFFER_COUNT; j++) {
+			buffer_finish(&subsurface->buffers[j]);
+		}
+		wl_subsurface_destroy(subsurface->subsurface);
+		wl_surface_destroy(subsurface->surface);
+	}
+	for (int i = 0; i < BUFFER_COUNT; i++) {
+		buffer_finish(&window->buffers[i]);
+	}
+	if (window->decoration) {
+		zxdg_toplevel_decoration_v1_destroy(window->decoration);
+	}
+	if (window->xdg_popup) {
+		xdg_popup_destroy(window->xdg_popup);
+	} else {
+		xdg_toplevel_destroy(window->xdg_toplevel);
+	}
+	xdg_surface_destroy(window->xdg_surface);
+	wl_surface_destroy(window->surface);
+	free(window);
+}
+
+#if CAGE_TEST_HAS_XCB
+static void
+x11_connect(struct cg_test_client *client)
+{
+	if (!getenv("DISPLAY")) {
+		return;
+	}
+	client->xcb = xcb_connect(NULL, NULL);
+	if (xcb_connection_has_error(client->xcb)) {
+		fprintf(stderr, "Unable to connect to XWayland, churning Wayland windows only\n");
+		xcb_disconnect(client->xcb);
+		client->xcb = NULL;
+		return;
+	}
+	client->x11_screen = xcb_setup_roots_iterator(xcb_get_setup(client->xcb)).data;
+}
+
+static void
+x11_churn_step(struct cg_test_client *client)
+{
+	xcb_connection_t *xcb = client->xcb;
+
+	if (client->x11_mapped) {
+		for (int i = 0; i < CG_TEST_X11_WINDOW_COUNT; i++) {
+			xcb_destroy_window(xcb, client->x11_windows[i]);
+		}
+		client->x11_mapped = false;
+		xcb_flush(xcb);
+		return;
+	}
+
+	xcb_screen_t *screen = client->x11_screen;
+	for (int i = 0; i < CG_TEST_X11_WINDOW_COUNT; i++) {
+		uint32_t values[] = {screen->white_pixel, i == CG_TEST_X11_MENU};
+		client->x11_windows[i] = xcb_generate_id(xcb);
+		xcb_create_window(xcb, XCB_COPY_FROM_PARENT, client->x11_windows[i], screen->root, 0, 0, 200, 150, 0,
+				  XCB_WINDOW_CLASS_INPUT_OUTPUT, screen->root_visual,
+				  XCB_CW_BACK_PIXEL | XCB_CW_OVERRIDE_REDIRECT, values);
+	}
+	xcb_change_property(xcb, XCB_PROP_MODE_REPLACE, client->x11_windows[CG_TEST_X11_DIALOG],
+			    XCB_ATOM_WM_TRANSIENT_FOR, XCB_ATOM_WINDOW, 32, 1, &client->x11_windows[CG_TEST_X11_MAIN]);
+	for (int i = 0; i < CG_TEST_X11_WINDOW_COUNT; i++) {
+		xcb_map_window(xcb, client->x11_windows[i]);
+	}
+	client->x11_mapped = true;
+	xcb_flush(xcb);
+}
+
+/* Nothing is selected, so these are errors at most. */
+static bool
+x11_dispatch(struct cg_test_client *client)
+{
+	xcb_generic_event_t *event;
+	while ((event = xcb_poll_for_event(client->xcb))) {
+		free(event);
+	}
+	if (xcb_connection_has_error(client->xcb)) {
+		fprintf(stderr, "Lost the connection to XWayland\n");
+		xcb_disconnect(client->xcb);
+		client->xcb = NULL;
+		return false;
+	}
+	return true;
+}
+#endif
+
+/* Opens a dialog and a popup of the main window, or closes them if they are
+ * open. */
+static void
+churn_step(struct cg_test_client *client)
+{
+	if (client->dialog) {
+		window_destroy(client->popup);
+		window_destroy(client->dialog);
+		client->popup = NULL;
+		client->dialog = NULL;
+	} else {
+		client->dialog = window_create(client, client->window, false);
+		client->popup = window_create(client, client->window, true);
+		if (!client->dialog || !client->popup) {
+			fprintf(stderr, "Unable to create a window\n");
+			client->running = false;
+			return;
+		}
+	}
+
+#if CAGE_TEST_HAS_XCB
+	if (client->xcb) {
+		x11_churn_step(client);
+	}
+#endif
+}
+
+/* Event times are in msec of CLOCK_MONOTONIC, so the latency is up to
+ * 1 msec too high. */
+static void
+log_latency(struct cg_test_client *client, const char *device, uint32_t time)
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	int64_t now_usec = (int64_t) now.tv_sec * 1000000 + now.tv_nsec / 1000;
+	/* Like the event time, in msec that wrap around at 32 bits. */
+	uint32_t msec = (uint32_t) (now_usec / 1000) - time;
+	fprintf(client->latency_log, "%s %" PRId64 "\n", device, (int64_t) msec * 1000 + now_usec % 1000);
+}
+
+static void
+handle_pointer_enter(void *data, struct wl_pointer *pointer, uint32_t serial, struct wl_surface *surface,
+		     wl_fixed_t sx, wl_fixed_t sy)
+{
+	/* No-op */
+}
+
+static void
+handle_pointer_leave(void *data, struct wl_pointer *pointer, uint32_t serial, struct wl_surface *surface)
+{
+	/* No-op */
+}
+
+static void
+handle_pointer_motion(void *data, struct wl_pointer *pointer, uint32_t time, wl_fixed_t sx, wl_fixed_t sy)
+{
+	log_latency(data, "pointer", time);
+}
+
+static void
+handle_pointer_button(void *data, struct wl_pointer *pointer, uint32_t serial, uint32_t time, uint32_t button,
+		      uint32_t state)
+{
+	log_latency(data, "pointer", time);
+}
+
+static void
+handle_pointer_axis(void *data, struct wl_pointer *pointer, uint32_t time, uint32_t axis, wl_fixed_t value)
+{
+	log_latency(data, "pointer", time);
+}
+
+static void
+handle_pointer_frame(void *data, struct wl_pointer *pointer)
+{
+	struct cg_test_client *client = data;
+	fflush(client->latency_log);
+}
+
+static void
+handle_pointer_axis_source(void *data, struct wl_pointer *pointer, uint32_t source)
+{
+	/* No-op */
+}
+
+static void
+handle_pointer_axis_stop(void *data, struct wl_pointer *pointer, uint32_t time, uint32_t axis)
+{
+	/* No-op */
+}
+
+static void
+handle_pointer_axis_discrete(void *data, struct wl_pointer *pointer, uint32_t axis, int32_t discrete)
+{
+	/* No-op */
+}
+
+static const struct wl_pointer_listener pointer_listener = {
+	.enter = handle_pointer_enter,
+	.leave = handle_pointer_leave,
+	.motion = handle_pointer_motion,
+	.button = handle_pointer_button,
+	.axis = handle_pointer_axis,
+	.frame = handle_pointer_frame,
+	.axis_source = handle_pointer_axis_source,
+	.axis_stop = handle_pointer_axis_stop,
+	.axis_discrete = handle_pointer_axis_discrete,
+};
+
+static void
+handle_touch_down(void *data, struct wl_touch *touch, uint32_t serial, uint32_t time, struct wl_surface *surface,
+		  int32_t id, wl_fixed_t x, wl_fixed_t y)
+{
+	log_latency(data, "touch", time);
+}
+
+static void
+handle_touch_up(void *data, struct wl_touch *touch, uint32_t serial, uint32_t time, int32_t id)
+{
+	log_latency(data, "touch", time);
+}
+
+static void
+handle_touch_motion(void *data, struct wl_touch *touch, uint32_t time, int32_t id, wl_fixed_t x, wl_fixed_t y)
+{
+	log_latency(data, "touch", time);
+}
+
+static void
+handle_touch_frame(void *data, struct wl_touch *touch)
+{
+	struct cg_test_client *client = data;
+	fflush(client->latency_log);
+}
+
+static void
+handle_touch_cancel(void *data, struct wl_touch *touch)
+{
+	/* No-op */
+}
+
+static const struct wl_touch_listener touch_listener = {
+	.down = handle_touch_down,
+	.up = handle_touch_up,
+	.motion = handle_touch_motion,
+	.frame = handle_touch_frame,
+	.cancel = handle_touch_cancel,
+};
+
+static void
+handle_seat_capabilities(void *data, struct wl_seat *seat, uint32_t capabilities)
+{
+	struct cg_test_client *client = data;
+
+	bool has_pointer = capabilities & WL_SEAT_CAPABILITY_POINTER;
+	if (has_pointer && !client->pointer) {
+		client->pointer = wl_seat_get_pointer(seat);
+		wl_pointer_add_listener(client->pointer, &pointer_listener, client);
+	} else if (!has_pointer && client->pointer) {
+		wl_pointer_destroy(client->pointer);
+		client->pointer = NULL;
+	}
+
+	bool has_touch = capabilities & WL_SEAT_CAPABILITY_TOUCH;
+	if (has_touch && !client->touch) {
+		client->touch = wl_seat_get_touch(seat);
+		wl_touch_add_listener(client->touch, &touch_listener, client);
+	} else if (!has_touch && client->touch) {
+		wl_touch_destroy(client->touch);
+		client->touch = NULL;
+	}
+}
+
+static void
+handle_seat_name(void *data, struct wl_seat *seat, const char *name)
+{
+	/* No-op */
+}
+
+static const struct wl_seat_listener seat_listener = {
+	.capabilities = handle_seat_capabilities,
+	.name = handle_seat_name,
+};
+
+static void
+handle_wm_base_ping(void *data, struct xdg_wm_base *wm_base, uint32_t serial)
+{
+	xdg_wm_base_pong(wm_base, serial);
+}
+
+static const struct xdg_wm_base_listener wm_base_listener = {
+	.ping = handle_wm_base_ping,
+};
+
+static void
+handle_global(void *data, struct wl_registry *registry, uint32_t name, const char *interface, uint32_t version)
+{
+	struct cg_test_client *client = data;
+
+	if (strcmp(interface, wl_compositor_interface.name) == 0 && version >= 4) {
+		client->compositor = wl_registry_bind(registry, name, &wl_compositor_interface, 4);
+	} else if (strcmp(interface, wl_subcompositor_interface.name) == 0) {
+		client->subcompositor = wl_registry_bind(registry, name, &wl_subcompositor_interface, 1);
+	} else if (strcmp(interface, wl_shm_interface.name) == 0) {
+		client->shm = wl_registry_bind(registry, name, &wl_shm_interface, 1);
+	} else if (strcmp(interface, xdg_wm_base_interface.name) == 0) {
+		client->wm_base = wl_registry_bind(registry, name, &xdg_wm_base_interface, 1);
+		xdg_wm_base_add_listener(client->wm_base, &wm_base_listener, client);
+	} else if (strcmp(interface, wl_seat_interface.name) == 0 && client->latency_log && !client->seat) {
+		/* Version 5 for wl_pointer.frame. */
+		client->seat = wl_registry_bind(registry, name, &wl_seat_interface, version < 5 ? version : 5);
+		wl_seat_add_listener(client->seat, &seat_listener, client);
+	} else if (strcmp(interface, zxdg_decoration_manager_v1_interface.name) == 0) {
+		client->decoration_manager = wl_registry_bind(registry, name, &zxdg_decoration_manager_v1_interface, 1);
+	}
+}
+
+static void
+handle_global_remove(void *data, struct wl_registry *registry, uint32_t name)
+{
+	/* No-op */
+}
+
+static const struct wl_registry_listener registry_listener = {
+	.global = handle_global,
+	.global_remove = handle_global_remove,
+};
+
+/* Returns how long to wait for events before the next churn step is due,
+ * in msec, or -1 to wait for events only. */
+static int
+churn_timeout(struct cg_test_client *client)
+{
+	/* Churn starts once the main window is shown. */
+	if (client->mode != CG_TEST_CHURN || client->window->frame == 0) {
+		return -1;
+	}
+
+	int64_t now = now_msec();
+	if (client->next_step == 0) {
+		client->next_step = now + client->churn_interval;
+	}
+	while (client->next_step <= now) {
+		churn_step(client);
+		client->next_step += client->churn_interval;
+	}
+	return (int) (client->next_step - now);
+}
+
+/* Dispatches events until the toplevel is closed or the compositor goes
+ * away, which is how the benchmark and the soak test end. */
+static int
+client_run(struct cg_test_client *client)
+{
+	struct pollfd pollfds[2] = {
+		{
+			.fd = wl_display_get_fd(client->display),
+			.events = POLLIN,
+		},
+		{
+			.fd = -1,
+			.events = POLLIN,
+		},
+	};
+
+	while (client->running) {
+		int timeout = churn_timeout(client);
+#if CAGE_TEST_HAS_XCB
+		pollfds[1].fd = client->xcb && x11_dispatch(client) ? xcb_get_file_descriptor(client->xcb) : -1;
+#endif
+
+		while (wl_display_prepare_read(client->display) != 0) {
+			if (wl_display_dispatch_pending(client->display) < 0) {
+				return 1;
+			}
+		}
+		if (wl_display_flush(client->display) < 0 && errno != EAGAIN) {
+			wl_display_cancel_read(client->display);
+			return 0;
+		}
+
+		int ret = poll(pollfds, 2, timeout);
+		if (ret < 0) {
+			wl_display_cancel_read(client->display);
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			return 1;
+		}
+		if (pollfds[0].revents == 0) {
+			wl_display_cancel_read(client->display);
+			continue;
+		}
+		if (wl_display_read_events(client->display) < 0 || wl_display_dispatch_pending(client->display) < 0) {
+			/* The compositor is gone. */
+			return 0;
+		}
+	}
+	return 0;
+}
+
+static void
+usage(FILE *file, const char *name)
+{
+	fprintf(file,
+		"Usage: %s [OPTIONS]\n"
+		"\n"
+		" -i <msec>\t Open or close the windows every msec in churn mode (default %d)\n"
+		" -l <file>\t Log the latency of pointer and touch events to file, in µs\n"
+		" -m <mode>\t frames: redraw the whole surface every frame (default)\n"
+		"\t\t damage: redraw a small square every frame\n"
+		"\t\t subsurfaces: redraw the surface and its subsurfaces every frame\n"
+		"\t\t popups: redraw a small square and open a new popup every frame\n"
+		"\t\t churn: open and close a dialog, a popup and X11 windows\n"
+		" -n <count>\t Number of subsurfaces in subsurfaces mode (default %d, at most %d)\n"
+		" -x\t\t Don't open X11 windows in churn mode\n"
+		" -h\t\t Display this help message\n",
+		name, CHURN_INTERVAL, SUBSURFACE_COUNT, MAX_SUBSURFACES);
+}
+
+int
+main(int argc, char *argv[])
+{
+	struct cg_test_client client = {
+		.mode = CG_TEST_FRAMES,
+		.churn_interval = CHURN_INTERVAL,
+		.subsurface_count = SUBSURFACE_COUNT,
+		.use_x11 = true,
+		.running = true,
+	};
+
+	int c;
+	while ((c = getopt(argc, argv, "i:l:m:n:xh")) != -1) {
+		switch (c) {
+		case 'i':
+			client.churn_interval = atoi(optarg);
+			if (client.churn_interval <= 0) {
+				fprintf(stderr, "Invalid interval %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'l':
+			client.latency_log = fopen(optarg, "w");
+			if (!client.latency_log) {
+				perror(optarg);
+				return 1;
+			}
+			break;
+		case 'm':
+			if (strcmp(optarg, "frames") == 0) {
+				client.mode = CG_TEST_FRAMES;
+			} else if (strcmp(optarg, "damage") == 0) {
+				client.mode = CG_TEST_DAMAGE;
+			} else if (strcmp(optarg, "subsurfaces") == 0) {
+				client.mode = CG_TEST_SUBSURFACES;
+			} else if (strcmp(optarg, "popups") == 0) {
+				client.mode = CG_TEST_POPUPS;
+			} else if (strcmp(optarg, "churn") == 0) {
+				client.mode = CG_TEST_CHURN;
+			} else {
+				fprintf(stderr, "Unknown mode %s\n", optarg);
+				usage(stderr, argv[0]);
+				return 1;
+			}
+			break;
+		case 'n':
+			client.subsurface_count = atoi(optarg);
+			if (client.subsurface_count <= 0 || client.subsurface_count > MAX_SUBSURFACES) {
+				fprintf(stderr, "Invalid number of subsurfaces %s\n", optarg);
+				return 1;
+			}
+			break;
+		case 'x':
+			client.use_x11 = false;
+			break;
+		case 'h':
+			usage(stdout, argv[0]);
+			return 0;
+		default:
+			usage(stderr, argv[0]);
+			return 1;
+		}
+	}
+
+	client.display = wl_display_connect(NULL);
+	if (!client.display) {
+		fprintf(stderr, "Unable to connect to the compositor\n");
+		return 1;
+	}
+	client.registry = wl_display_get_registry(client.display);
+	wl_registry_add_listener(client.registry, &registry_listener, &client);
+	wl_display_roundtrip(client.display);
+	if (!client.compositor || !client.subcompositor || !client.shm || !client.wm_base) {
+		fprintf(stderr, "The compositor lacks wl_compositor 4, wl_subcompositor, wl_shm or xdg_wm_base\n");
+		return 1;
+	}
+
+	client.window = window_create(&client, NULL, false);
+	if (!client.window) {
+		return 1;
+	}
+	if (client.mode == CG_TEST_SUBSURFACES) {
+		window_add_subsurfaces(client.window, client.subsurface_count);
+	}
+#if CAGE_TEST_HAS_XCB
+	if (client.mode == CG_TEST_CHURN && client.use_x11) {
+		x11_connect(&client);
+	}
+#endif
+
+	int ret = client_run(&client);
+
+#if CAGE_TEST_HAS_XCB
+	if (client.xcb) {
+		xcb_disconnect(client.xcb);
+	}
+#endif
+	if (client.popup) {
+		window_destroy(client.popup);
+	}
+	if (client.dialog) {
+		window_destroy(client.dialog);
+	}
+	window_destroy(client.window);
+	if (client.pointer) {
+		wl_pointer_destroy(client.pointer);
+	}
+	if (client.touch) {
+		wl_touch_destroy(client.touch);
+	}
+	if (client.seat) {
+		wl_seat_destroy(client.seat);
+	}
+	if (client.latency_log) {
+		fclose(client.latency_log);
+	}
+	if (client.decoration_manager) {
+		zxdg_decoration_manager_v1_destroy(client.decoration_manager);
+	}
+	xdg_wm_base_destroy(client.wm_base);
+	wl_shm_destroy(client.shm);
+	wl_subcompositor_destroy(client.subcompositor);
+	wl_compositor_destroy(client.compositor);
+	wl_registry_destroy(client.registry);
+	wl_display_disconnect(client.display);
+	return ret;
+}
@@ -0,0 +1,154 @@
+"""Runs Cage on the headless backend and queries it over its IPC socket."""
+
+import glob
+import os
+import shutil
+import signal
+import socket
+import subprocess
+import sys
+import tempfile
+import time
+
+CLK_TCK = os.sysconf("SC_CLK_TCK")
+
+# The fields of the stats reply that are histograms.
+HISTOGRAMS = {"map", "unmap", "destroy", "popup", "decoration", "skew", "dispatch", "flush", "frame_to_commit",
+              "commit", "commit_to_present"}
+
+
+class Cage:
+    """Cage with one headless output, running command in a private
+    XDG_RUNTIME_DIR and XDG_STATE_HOME. Extra environment variables for
+    Cage, and through it for the command, are given in env."""
+
+    def __init__(self, cage, args, command, env=None):
+        self.runtime_dir = tempfile.mkdtemp(prefix="cage-test-")
+        self.log_path = os.path.join(self.runtime_dir, "log")
+        environ = dict(os.environ)
+        for name in ("WAYLAND_DISPLAY", "WAYLAND_SOCKET", "DISPLAY"):
+            environ.pop(name, None)
+        environ.update(
+            XDG_RUNTIME_DIR=self.runtime_dir,
+            XDG_STATE_HOME=self.runtime_dir,
+            WLR_BACKENDS="headless",
+            WLR_HEADLESS_OUTPUTS="1",
+            WLR_RENDERER="pixman",
+            WLR_LIBINPUT_NO_DEVICES="1",
+        )
+        environ.update(env or {})
+
+        with open(self.log_path, "w") as log:
+            self.process = subprocess.Popen(
+                [cage, "-C"] + args + ["--"] + command, env=environ, stderr=log
+            )
+        self.socket_path = self._wait_for_socket()
+
+    def _wait_for_socket(self):
+        for _ in range(100):
+            paths = glob.glob(os.path.join(self.runtime_dir, "cage-*.sock"))
+            if paths:
+                return paths[0]
+            if self.process.poll() is not None:
+                break
+            time.sleep(0.1)
+        self.close()
+        raise RuntimeError("Cage didn't start, see its log:\n" + self.log())
+
+    def log(self):
+        try:
+            with open(self.log_path) as log:
+                return log.read()
+        except OSError:
+            return ""
+
+    def query(self, command):
+        """Sends command and returns the lines of its reply."""
+        with socket.socket(socket.AF_UNIX, socket.SOCK_STREAM) as sock:
+            sock.connect(self.socket_path)
+            sock.sendall(command.encode() + b"\n")
+            reply = b""
+            while True:
+                data = sock.recv(65536)
+                if not data:
+                    break
+                reply += data
+                # The reply ends with a line that is "ok" or "error <reason>".
+                if reply.endswith(b"\n"):
+                    last = reply[:-1].rsplit(b"\n", 1)[-1]
+                    if last == b"ok" or last.startswith(b"error "):
+                        break
+        lines = reply.decode(errors="replace").splitlines()
+        if not lines or lines[-1] != "ok":
+            raise RuntimeError("IPC command {} failed: {}".format(command, lines[-1:] or "no reply"))
+        return lines[:-1]
+
+    def _parse_stats(self, command):
+        """Returns the lines of a stats or histograms reply as dicts of
+        their key=value fields, keyed by the fields before them, such as
+        "views" or "output HEADLESS-1"."""
+        stats = {}
+        for line in self.query(command):
+            fields = line.split()
+            name = " ".join(f for f in fields if "=" not in f)
+            stats[name] = dict(f.split("=", 1) for f in fields if "=" in f)
+        return stats
+
+    def stats(self):
+        return self._parse_stats("stats")
+
+    def histograms(self):
+        """Like stats, with the histograms as lists of bucket counts."""
+        stats = self._parse_stats("histograms")
+        for values in stats.values():
+            for key, value in values.items():
+                if key in HISTOGRAMS:
+                    values[key] = [int(v) for v in value.split(",")]
+        return stats
+
+    def cpu_seconds(self):
+        """Returns the user and system time Cage has used."""
+        with open("/proc/{}/stat".format(self.process.pid)) as stat:
+            # The command name may contain spaces, the fields after it don't.
+            fields = stat.read().rsplit(")", 1)[1].split()
+        return (int(fields[11]) + int(fields[12])) / CLK_TCK
+
+    def close(self):
+        if self.process.poll() is None:
+            self.process.send_signal(signal.SIGTERM)
+            try:
+                self.process.wait(timeout=10)
+            except subprocess.TimeoutExpired:
+                self.process.kill()
+                self.process.wait()
+        shutil.rmtree(self.runtime_dir, ignore_errors=True)
+
+    def __enter__(self):
+        return self
+
+    def __exit__(self, *exc):
+        self.close()
+
+
+def percentile(buckets, fraction):
+    """Returns the upper bound in µs of the bucket holding the given
+    percentile, like histogram_percentile, or 0 if there are no samples."""
+    rank = int(fraction * sum(buckets))
+    seen = 0
+    for i, count in enumerate(buckets):
+        seen += count
+        if seen > rank:
+            return 1 if i == 0 else 1 << i
+    return 0
+
+
+def delta_percentile(before, after, fraction):
+    """Returns the percentile of the samples added between two replies of
+    the histograms command."""
+    before = before + [0] * (len(after) - len(before))
+    return percentile([b - a for a, b in zip(before, after)], fraction)
+
+
+def fail(message):
+    print(message, file=sys.stderr)
+    sys.exit(1)
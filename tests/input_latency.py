@@ -0,0 +1,143 @@
+#!/usr/bin/env python3
+"""Replays a generated input recording with -P into the test client and
+reports how long the pointer and touch events took from the time they
+carry to their arrival at the client. Cage records what it replays with
+-R, and the recording has to match the replayed one.
+
+Event times have a resolution of 1 ms, so the latencies are up to 1 ms
+too high."""
+
+import argparse
+import os
+import shutil
+import struct
+import tempfile
+import time
+
+import harness
+
+# struct cg_record_header and struct cg_record in record.h.
+HEADER = struct.Struct("=8sII")
+RECORD = struct.Struct("=QIIiiiidddd")
+RECORD_MAGIC = b"cageinpt"
+RECORD_VERSION = 1
+
+# enum cg_record_type
+POINTER_MOTION_ABSOLUTE = 2
+POINTER_BUTTON = 3
+POINTER_FRAME = 5
+TOUCH_DOWN = 6
+TOUCH_UP = 7
+TOUCH_MOTION = 8
+TOUCH_FRAME = 9
+
+BTN_LEFT = 0x110
+
+
+def generate(duration, interval):
+    """Returns the records of a pointer moving across the output with a
+    click every 50 events, followed by swipes of a single finger, each
+    taking half of the duration. Events are interval seconds apart."""
+    records = []
+    nsec = 0
+    step = int(interval * 1e9)
+    count = int(duration / interval / 2)
+
+    def add(record_type, a=0, b=0, x=0.0, y=0.0, frame=None):
+        nonlocal nsec
+        nsec += step
+        records.append((nsec, 0, record_type, a, b, 0, 0, x, y, 0.0, 0.0))
+        records.append((nsec, 0, frame, 0, 0, 0, 0, 0.0, 0.0, 0.0, 0.0))
+
+    for i in range(count):
+        if i % 50 == 25:
+            add(POINTER_BUTTON, BTN_LEFT, 1, frame=POINTER_FRAME)
+            add(POINTER_BUTTON, BTN_LEFT, 0, frame=POINTER_FRAME)
+        else:
+            add(POINTER_MOTION_ABSOLUTE, x=(i % 100) / 100, y=(i % 77) / 77, frame=POINTER_FRAME)
+
+    for i in range(count):
+        x = 0.1 + (i % 20) * 0.04
+        if i % 20 == 0:
+            add(TOUCH_DOWN, 0, x=x, y=0.5, frame=TOUCH_FRAME)
+        elif i % 20 == 19:
+            add(TOUCH_UP, 0, frame=TOUCH_FRAME)
+        else:
+            add(TOUCH_MOTION, 0, x=x, y=0.5, frame=TOUCH_FRAME)
+    return records
+
+
+def write_recording(path, records):
+    with open(path, "wb") as recording:
+        recording.write(HEADER.pack(RECORD_MAGIC, RECORD_VERSION, RECORD.size))
+        for record in records:
+            recording.write(RECORD.pack(*record))
+
+
+def read_recording(path):
+    with open(path, "rb") as recording:
+        magic, version, size = HEADER.unpack(recording.read(HEADER.size))
+        if magic != RECORD_MAGIC or version != RECORD_VERSION or size != RECORD.size:
+            harness.fail("{} is not an input recording of this version".format(path))
+        data = recording.read()
+    return [RECORD.unpack_from(data, offset) for offset in range(0, len(data) - RECORD.size + 1, RECORD.size)]
+
+
+def wait_for_log(cage, text, timeout):
+    deadline = time.monotonic() + timeout
+    while text not in cage.log():
+        if time.monotonic() > deadline or cage.process.poll() is not None:
+            harness.fail("Cage didn't log \"{}\", see its log:\n{}".format(text, cage.log()))
+        time.sleep(0.1)
+
+
+def summary(latencies):
+    latencies = sorted(latencies)
+    return (len(latencies), latencies[len(latencies) // 2], latencies[int(len(latencies) * 0.99)],
+            latencies[-1])
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("cage", help="the Cage executable")
+    parser.add_argument("client", help="the cage-test-client executable")
+    parser.add_argument("-d", "--duration", type=float, default=10, help="seconds of input to replay")
+    parser.add_argument("-i", "--interval", type=float, default=0.004, help="seconds between events")
+    args = parser.parse_args()
+
+    work_dir = tempfile.mkdtemp(prefix="cage-input-latency-")
+    try:
+        fixture = os.path.join(work_dir, "fixture")
+        recording = os.path.join(work_dir, "recording")
+        latency_log = os.path.join(work_dir, "latency")
+        records = generate(args.duration, args.interval)
+        write_recording(fixture, records)
+
+        with harness.Cage(args.cage, ["-P", fixture, "-R", recording],
+                          [args.client, "-m", "damage", "-l", latency_log]) as cage:
+            wait_for_log(cage, "Replayed {} input events".format(len(records)), args.duration * 2 + 10)
+            # Let the client handle the last events.
+            time.sleep(0.5)
+
+        recorded = read_recording(recording)
+        if [r[2] for r in recorded] != [r[2] for r in records]:
+            harness.fail("Recorded {} events, which differ from the {} replayed".format(len(recorded),
+                                                                                      len(records)))
+
+        latencies = {"pointer": [], "touch": []}
+        with open(latency_log) as log:
+            for line in log:
+                device, usec = line.split()
+                latencies[device].append(int(usec))
+    finally:
+        shutil.rmtree(work_dir, ignore_errors=True)
+
+    print("{:<8} {:>8} {:>10} {:>10} {:>10}".format("device", "events", "p50 µs", "p99 µs", "max µs"))
+    for device, values in latencies.items():
+        if not values:
+            harness.fail("The client received no {} events".format(device))
+        print("{:<8} {:>8} {:>10} {:>10} {:>10}".format(device, *summary(values)))
+
+
+if __name__ == "__main__":
+    main()
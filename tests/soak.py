@@ -0,0 +1,115 @@
+#!/usr/bin/env python3
+"""Runs Cage on the headless backend with the test client in churn mode,
+which keeps opening and closing dialogs, popups, decorated windows and,
+with XWayland, X11 windows. It samples Cage's resident memory, its live
+allocations and the p99 latency of mapping, unmapping and destroying
+views and of setting up popups and decorations in each window of time,
+and fails if they grew past the given limits after the warm-up."""
+
+import argparse
+import os
+import struct
+import tempfile
+import time
+
+import harness
+
+# The histograms of the views line whose p99 is checked.
+LATENCIES = ("map", "unmap", "destroy", "popup", "decoration")
+
+
+class AllocCounter:
+    """Reads the counters of the alloc_count preload library."""
+
+    def __init__(self, library):
+        self.library = os.path.abspath(library)
+        self.file = tempfile.NamedTemporaryFile(prefix="cage-alloc-count-")
+
+    def env(self):
+        return {"LD_PRELOAD": self.library, "CAGE_ALLOC_COUNT_FILE": self.file.name}
+
+    def live(self):
+        # struct alloc_counters: allocs and frees.
+        self.file.seek(0)
+        allocs, frees = struct.unpack("=QQ", self.file.read(16))
+        return allocs - frees
+
+
+class Sample:
+    def __init__(self, cage, alloc_counter):
+        histograms = cage.histograms()
+        self.time = time.monotonic()
+        self.rss_kib = int(histograms["memory"]["rss"]) // 1024
+        self.destroyed = int(histograms["views"]["destroyed"])
+        self.latencies = {name: histograms["views"][name] for name in LATENCIES}
+        self.live = alloc_counter.live() if alloc_counter else None
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("cage", help="the Cage executable")
+    parser.add_argument("client", help="the cage-test-client executable")
+    parser.add_argument("-d", "--duration", type=float, default=600, help="seconds to run for")
+    parser.add_argument("-i", "--interval", type=float, default=10, help="seconds per window")
+    parser.add_argument("-m", "--max-rss-growth", type=int, default=4096, help="in KiB")
+    parser.add_argument("-a", "--max-live-growth", type=float, default=0.1,
+                        help="growth of the live allocations per destroyed view")
+    # Latencies are bucketed by powers of two, so a factor below 2 is noise.
+    parser.add_argument("-l", "--max-latency-factor", type=int, default=4,
+                        help="growth of the p99 latencies of a window")
+    parser.add_argument("--alloc-count", help="the alloc_count preload library")
+    args = parser.parse_args()
+
+    alloc_counter = AllocCounter(args.alloc_count) if args.alloc_count else None
+    env = alloc_counter.env() if alloc_counter else {}
+
+    print("{:>8} {:>10} {:>12} {:>10}".format("seconds", "rss KiB", "live allocs", "destroyed")
+          + "".join(" {:>14}".format(name + " p99") for name in LATENCIES))
+    with harness.Cage(args.cage, [], [args.client, "-m", "churn"], env=env) as cage:
+        start = time.monotonic()
+        # The first window is the warm-up and the second the baseline;
+        # the latencies of each window are compared, not those of the
+        # whole run, so that a slowdown late in the run isn't averaged out.
+        time.sleep(args.interval)
+        samples = [Sample(cage, alloc_counter)]
+        windows = []
+        while samples[-1].time - start < args.duration or len(windows) < 2:
+            time.sleep(args.interval)
+            if cage.process.poll() is not None:
+                harness.fail("Cage exited, see its log:\n" + cage.log())
+            before = samples[-1]
+            sample = Sample(cage, alloc_counter)
+            window = [harness.delta_percentile(before.latencies[name], sample.latencies[name], 0.99)
+                      for name in LATENCIES]
+            samples.append(sample)
+            windows.append(window)
+            print("{:>8.0f} {:>10} {:>12} {:>10}".format(
+                sample.time - start, sample.rss_kib, "-" if sample.live is None else sample.live,
+                sample.destroyed - before.destroyed) + "".join(" {:>14}".format(p99) for p99 in window), flush=True)
+
+    failures = []
+    base, last = samples[0], samples[-1]
+    destroyed = last.destroyed - base.destroyed
+    if destroyed == 0:
+        failures.append("no views were destroyed, the client isn't churning")
+
+    rss_growth = last.rss_kib - base.rss_kib
+    if rss_growth > args.max_rss_growth:
+        failures.append("resident memory grew by {} KiB, more than {} KiB".format(rss_growth, args.max_rss_growth))
+    if alloc_counter and destroyed > 0:
+        live_growth = (last.live - base.live) / destroyed
+        if live_growth > args.max_live_growth:
+            failures.append("live allocations grew by {:.2f} per destroyed view, more than {}".format(
+                live_growth, args.max_live_growth))
+    for i, name in enumerate(LATENCIES):
+        base_p99, last_p99 = windows[0][i], windows[-1][i]
+        if base_p99 > 0 and last_p99 > base_p99 * args.max_latency_factor:
+            failures.append("p99 {} latency grew from {} to {} µs".format(name, base_p99, last_p99))
+
+    if failures:
+        harness.fail("\n".join("FAIL: " + failure for failure in failures))
+    print("PASS")
+
+
+if __name__ == "__main__":
+    main()
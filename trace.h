@@ -0,0 +1,23 @@
+#ifndef CG_TRACE_H
+#define CG_TRACE_H
+
+#include "config.h"
+
+/* Static tracepoints for perf and bpftrace, for example:
+ *   bpftrace -e 'usdt:/usr/bin/cage:cage:repaint_end { printf("%s\n", str(arg0)); }'
+ * A tracepoint is a single nop until a tracer attaches to it. Arguments
+ * must be integers or pointers; strings are passed as pointers. */
+#if CAGE_HAS_TRACEPOINTS
+#include <sys/sdt.h>
+#define CG_TRACE(name) DTRACE_PROBE(cage, name)
+#define CG_TRACE1(name, a) DTRACE_PROBE1(cage, name, a)
+#define CG_TRACE2(name, a, b) DTRACE_PROBE2(cage, name, a, b)
+#define CG_TRACE4(name, a, b, c, d) DTRACE_PROBE4(cage, name, a, b, c, d)
+#else
+#define CG_TRACE(name) ((void) 0)
+#define CG_TRACE1(name, a) ((void) 0)
+#define CG_TRACE2(name, a, b) ((void) 0)
+#define CG_TRACE4(name, a, b, c, d) ((void) 0)
+#endif
+
+#endif
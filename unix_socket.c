@@ -0,0 +1,138 @@
+/*
+ * Cage: A Wayland kiosk.
+ *
+ * Copyright (C) 2026 agent
+ *
+ * See the LICENSE file accompanying this file.
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <fcntl.h>
+#include <stdbool.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <wayland-server-core.h>
+#include <wlr/util/log.h>
+
+#include "unix_socket.h"
+
+static struct cg_unix_socket_client *
+unix_socket_client_at(struct cg_unix_socket *sock, int i)
+{
+	return (struct cg_unix_socket_client *) ((char *) sock->clients + i * sock->impl->client_size);
+}
+
+static int
+handle_connection(int fd, uint32_t mask, void *data)
+{
+	struct cg_unix_socket *sock = data;
+	const struct cg_unix_socket_impl *impl = sock->impl;
+
+	int client_fd = accept(fd, NULL, NULL);
+	if (client_fd < 0) {
+		wlr_log_errno(WLR_DEBUG, "Unable to accept %s connection", impl->name);
+		return 0;
+	}
+	if (fcntl(client_fd, F_SETFD, FD_CLOEXEC) == -1 ||
+	    fcntl(client_fd, F_SETFL, fcntl(client_fd, F_GETFL) | O_NONBLOCK) == -1) {
+		wlr_log_errno(WLR_ERROR, "Unable to set up %s connection", impl->name);
+		close(client_fd);
+		return 0;
+	}
+
+	struct cg_unix_socket_client *client = NULL;
+	for (int i = 0; i < impl->max_clients; i++) {
+		struct cg_unix_socket_client *slot = unix_socket_client_at(sock, i);
+		if (slot->fd < 0) {
+			client = slot;
+			break;
+		}
+	}
+	if (!client) {
+		wlr_log(WLR_ERROR, "Too many %s connections", impl->name);
+		close(client_fd);
+		return 0;
+	}
+
+	client->source =
+		wl_event_loop_add_fd(sock->event_loop, client_fd, WL_EVENT_READABLE, impl->handle_client_event, client);
+	if (!client->source) {
+		close(client_fd);
+		return 0;
+	}
+	client->fd = client_fd;
+	impl->client_accepted(client);
+	return 0;
+}
+
+/* Listens on path, replacing a stale socket left there by a previous
+ * instance, and accepts connections into the free slots of clients. */
+bool
+unix_socket_listen(struct cg_unix_socket *sock, const struct cg_unix_socket_impl *impl, void *clients,
+		   struct wl_event_loop *event_loop, const char *path)
+{
+	sock->impl = impl;
+	sock->clients = clients;
+	sock->event_loop = event_loop;
+	for (int i = 0; i < impl->max_clients; i++) {
+		struct cg_unix_socket_client *client = unix_socket_client_at(sock, i);
+		client->fd = -1;
+		client->source = NULL;
+	}
+
+	sock->addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(sock->addr.sun_path)) {
+		wlr_log(WLR_ERROR, "Path of the %s socket is too long", impl->name);
+		return false;
+	}
+	strcpy(sock->addr.sun_path, path);
+
+	sock->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC | SOCK_NONBLOCK, 0);
+	if (sock->fd < 0) {
+		wlr_log_errno(WLR_ERROR, "Unable to create %s socket", impl->name);
+		return false;
+	}
+
+	unlink(path);
+	if (bind(sock->fd, (struct sockaddr *) &sock->addr, sizeof(sock->addr)) != 0 || listen(sock->fd, 4) != 0) {
+		wlr_log_errno(WLR_ERROR, "Unable to listen on %s socket %s", impl->name, path);
+		close(sock->fd);
+		return false;
+	}
+
+	sock->source = wl_event_loop_add_fd(event_loop, sock->fd, WL_EVENT_READABLE, handle_connection, sock);
+	if (!sock->source) {
+		wlr_log(WLR_ERROR, "Unable to add %s socket to the event loop", impl->name);
+		unlink(path);
+		close(sock->fd);
+		return false;
+	}
+
+	return true;
+}
+
+void
+unix_socket_client_close(struct cg_unix_socket_client *client)
+{
+	wl_event_source_remove(client->source);
+	close(client->fd);
+	client->fd = -1;
+	client->source = NULL;
+}
+
+void
+unix_socket_finish(struct cg_unix_socket *sock)
+{
+	for (int i = 0; i < sock->impl->max_clients; i++) {
+		struct cg_unix_socket_client *client = unix_socket_client_at(sock, i);
+		if (client->fd >= 0) {
+			unix_socket_client_close(client);
+		}
+	}
+	wl_event_source_remove(sock->source);
+	close(sock->fd);
+	unlink(sock->addr.sun_path);
+}
@@ -0,0 +1,42 @@
+#ifndef CG_UNIX_SOCKET_H
+#define CG_UNIX_SOCKET_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/un.h>
+#include <wayland-server-core.h>
+
+/* A connection on a listening socket. Must be the first member of the
+ * client structs of the socket's user. */
+struct cg_unix_socket_client {
+	int fd; // -1 if the slot is free
+	struct wl_event_source *source;
+};
+
+struct cg_unix_socket_impl {
+	const char *name; // in log messages
+	int max_clients;
+	size_t client_size;
+	/* Called with the cg_unix_socket_client as data. */
+	wl_event_loop_fd_func_t handle_client_event;
+	/* Resets the state of a client that was given a new connection. */
+	void (*client_accepted)(struct cg_unix_socket_client *client);
+};
+
+/* A listening Unix socket with a fixed number of client slots, all
+ * allocated by its user up front. */
+struct cg_unix_socket {
+	const struct cg_unix_socket_impl *impl;
+	void *clients; // impl->max_clients structs of impl->client_size bytes
+	int fd;
+	struct sockaddr_un addr;
+	struct wl_event_loop *event_loop;
+	struct wl_event_source *source;
+};
+
+bool unix_socket_listen(struct cg_unix_socket *sock, const struct cg_unix_socket_impl *impl, void *clients,
+			struct wl_event_loop *event_loop, const char *path);
+void unix_socket_client_close(struct cg_unix_socket_client *client);
+void unix_socket_finish(struct cg_unix_socket *sock);
+
+#endif
@@ -12,14 +12,20 @@
 #include <stdbool.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <wayland-server-core.h>
+#include <wlr/types/wlr_buffer.h>
 #include <wlr/types/wlr_foreign_toplevel_management_v1.h>
 #include <wlr/types/wlr_output.h>
 #include <wlr/types/wlr_scene.h>
+#include <wlr/util/log.h>
 
 #include "output.h"
+#include "record.h"
 #include "seat.h"
 #include "server.h"
+#include "stats.h"
+#include "trace.h"
 #include "view.h"
 #if CAGE_HAS_XWAYLAND
 #include "xwayland.h"
@@ -82,25 +88,50 @@ view_center(struct cg_view *view, struct wlr_box *layout_box)
 	int width, height;
 	view->impl->get_geometry(view, &width, &height);
 
-	view->lx = (layout_box->width - width) / 2;
-	view->ly = (layout_box->height - height) / 2;
+	view->lx = layout_box->x + (layout_box->width - width) / 2;
+	view->ly = layout_box->y + (layout_box->height - height) / 2;
 
 	if (view->scene_tree) {
 		wlr_scene_node_set_position(&view->scene_tree->node, view->lx, view->ly);
 	}
 }
 
+/* Returns the part of the output layout the view is confined to: the
+ * output of its application if that is pinned to one, the mirror source
+ * when mirroring, the whole layout otherwise. The application is known
+ * once the view is mapped. */
+void
+view_get_layout_box(struct cg_view *view, struct wlr_box *box)
+{
+	struct cg_server *server = view->server;
+	struct cg_output *output = view->app ? view->app->output : output_mirror_source(server);
+	if (output && output->wlr_output->enabled) {
+		wlr_output_layout_get_box(server->output_layout, output->wlr_output, box);
+		if (!wlr_box_empty(box)) {
+			return;
+		}
+	}
+
+	wlr_output_layout_get_box(server->output_layout, NULL, box);
+}
+
+static void view_update_opaque_box(struct cg_view *view);
+
 void
 view_position(struct cg_view *view)
 {
 	struct wlr_box layout_box;
-	wlr_output_layout_get_box(view->server->output_layout, NULL, &layout_box);
+	view_get_layout_box(view, &layout_box);
 
 	if (view_is_primary(view) || view_extends_output_layout(view, &layout_box)) {
 		view_maximize(view, &layout_box);
 	} else {
 		view_center(view, &layout_box);
 	}
+
+	if (view->wlr_surface) {
+		view_update_opaque_box(view);
+	}
 }
 
 void
@@ -112,10 +143,153 @@ view_position_all(struct cg_server *server)
 	}
 }
 
+static void
+view_extents_iterator(struct wlr_scene_buffer *buffer, int sx, int sy, void *data)
+{
+	pixman_region32_t *extents = data;
+	int width = buffer->dst_width, height = buffer->dst_height;
+	if (width <= 0 || height <= 0) {
+		if (!buffer->buffer) {
+			return;
+		}
+		width = buffer->buffer->width;
+		height = buffer->buffer->height;
+	}
+	pixman_region32_union_rect(extents, extents, sx, sy, width, height);
+}
+
+/* Returns the layout area covered by all surfaces of the view, including
+ * subsurfaces and popups, regardless of whether it is currently hidden. */
+static void
+view_get_extents(struct cg_view *view, pixman_region32_t *extents)
+{
+	struct wlr_scene_node *node = &view->scene_tree->node;
+	struct wlr_scene_node *child;
+	wl_list_for_each (child, &view->scene_tree->children, link) {
+		pixman_region32_t child_extents;
+		pixman_region32_init(&child_extents);
+		wlr_scene_node_for_each_buffer(child, view_extents_iterator, &child_extents);
+		pixman_region32_translate(&child_extents, node->x, node->y);
+		pixman_region32_union(extents, extents, &child_extents);
+		pixman_region32_fini(&child_extents);
+	}
+}
+
+/* Disables the scene trees of views that are entirely covered by opaque
+ * views stacked above them. Hidden views are no longer walked by the
+ * scene and don't receive frame events, so they stop drawing. */
+static void
+view_update_occlusion(struct cg_server *server)
+{
+	pixman_region32_t covered;
+	pixman_region32_init(&covered);
+
+	/* Children of the scene tree are ordered from bottom to top. */
+	struct wlr_scene_node *node;
+	wl_list_for_each_reverse (node, &server->scene->tree.children, link) {
+		/* Only views have data; drag icons are never occluded, nor do
+		 * they occlude anything. */
+		struct cg_view *view = node->data;
+		if (!view) {
+			continue;
+		}
+
+		pixman_region32_t extents;
+		pixman_region32_init(&extents);
+		view_get_extents(view, &extents);
+		pixman_region32_subtract(&extents, &extents, &covered);
+		bool occluded = !pixman_region32_not_empty(&extents);
+		pixman_region32_fini(&extents);
+
+		if (occluded != view->occluded) {
+			wlr_log(WLR_DEBUG, "View %p is %s", (void *) view, occluded ? "occluded" : "visible");
+			view->occluded = occluded;
+			if (occluded) {
+				server->views_occluded++;
+			}
+		}
+		if (node->enabled == occluded) {
+			wlr_scene_node_set_enabled(node, !occluded);
+			server->hit_test_valid = false;
+		}
+
+		if (!occluded && !wlr_box_empty(&view->opaque_box)) {
+			pixman_region32_union_rect(&covered, &covered, view->opaque_box.x, view->opaque_box.y,
+						   view->opaque_box.width, view->opaque_box.height);
+		}
+	}
+
+	pixman_region32_fini(&covered);
+}
+
+static void
+handle_occlusion_idle(void *data)
+{
+	struct cg_server *server = data;
+	server->occlusion_idle = NULL;
+	view_update_occlusion(server);
+}
+
+/* Views are restacked, moved and resized in bursts, so occlusion is
+ * recomputed once the current batch of events has been dispatched. */
+void
+view_schedule_occlusion_update(struct cg_server *server)
+{
+	if (server->occlusion_idle) {
+		return;
+	}
+
+	struct wl_event_loop *event_loop = wl_display_get_event_loop(server->wl_display);
+	server->occlusion_idle = wl_event_loop_add_idle(event_loop, handle_occlusion_idle, server);
+	if (!server->occlusion_idle) {
+		wlr_log(WLR_ERROR, "Failed to schedule occlusion update, updating immediately");
+		view_update_occlusion(server);
+	}
+}
+
+static void
+view_update_opaque_box(struct cg_view *view)
+{
+	struct wlr_surface *surface = view->wlr_surface;
+	struct wlr_box box = {0};
+
+	/* The coordinates are valid even while the view is disabled. */
+	int lx, ly;
+	wlr_scene_node_coords(&view->scene_tree->node, &lx, &ly);
+	pixman_box32_t surface_box = {0, 0, surface->current.width, surface->current.height};
+	if (surface->current.width > 0 && surface->current.height > 0 &&
+	    pixman_region32_contains_rectangle(&surface->opaque_region, &surface_box) == PIXMAN_REGION_IN) {
+		box = (struct wlr_box){lx, ly, surface->current.width, surface->current.height};
+	}
+
+	if (!wlr_box_equal(&box, &view->opaque_box)) {
+		view->opaque_box = box;
+		view_schedule_occlusion_update(view->server);
+	}
+}
+
+static void
+handle_view_commit(struct wl_listener *listener, void *data)
+{
+	struct cg_view *view = wl_container_of(listener, view, commit);
+
+	/* A hidden view may have grown out from under the views above it. */
+	if (view->occluded) {
+		view_schedule_occlusion_update(view->server);
+	}
+	view_update_opaque_box(view);
+}
+
 void
 view_unmap(struct cg_view *view)
 {
+	CG_TRACE1(view_unmap, view);
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 	wl_list_remove(&view->link);
+	wl_list_remove(&view->commit.link);
+	view->server->hit_test_valid = false;
+	view_schedule_occlusion_update(view->server);
 
 	wl_list_remove(&view->request_activate.link);
 	wl_list_remove(&view->request_close.link);
@@ -126,6 +300,10 @@ view_unmap(struct cg_view *view)
 
 	view->wlr_surface->data = NULL;
 	view->wlr_surface = NULL;
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	histogram_add(&view->server->view_unmap_time, timespec_to_nsec(&end) - timespec_to_nsec(&start));
 }
 
 void
@@ -134,6 +312,8 @@ handle_surface_request_activate(struct wl_listener *listener, void *data)
 	struct cg_view *view = wl_container_of(listener, view, request_activate);
 
 	wlr_scene_node_raise_to_top(&view->scene_tree->node);
+	view->server->hit_test_valid = false;
+	view_schedule_occlusion_update(view->server);
 	seat_set_focus(view->server->seat, view);
 }
 
@@ -147,13 +327,26 @@ handle_surface_request_close(struct wl_listener *listener, void *data)
 void
 view_map(struct cg_view *view, struct wlr_surface *surface)
 {
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
 	view->scene_tree = wlr_scene_subsurface_tree_create(&view->server->scene->tree, surface);
 	if (!view->scene_tree)
 		goto fail;
 	view->scene_tree->node.data = view;
+	CG_TRACE2(view_map, view, view->impl->get_pid(view));
 
 	view->wlr_surface = surface;
 	surface->data = view;
+	view->occluded = false;
+	view->opaque_box = (struct wlr_box){0};
+	view->commit.notify = handle_view_commit;
+	wl_signal_add(&surface->events.commit, &view->commit);
+
+	/* Looked up once, as it walks up the process tree in /proc. */
+	if (view->server->app_per_output && !view->app) {
+		view->app = server_app_from_pid(view->server, view->impl->get_pid(view));
+	}
 
 #if CAGE_HAS_XWAYLAND
 	/* We shouldn't position override-redirect windows. They set
@@ -165,6 +358,8 @@ view_map(struct cg_view *view, struct wlr_surface *surface)
 	}
 
 	wl_list_insert(&view->server->views, &view->link);
+	view->server->hit_test_valid = false;
+	view_schedule_occlusion_update(view->server);
 
 	view->foreign_toplevel_handle = wlr_foreign_toplevel_handle_v1_create(view->server->foreign_toplevel_manager);
 	if (!view->foreign_toplevel_handle)
@@ -176,6 +371,13 @@ view_map(struct cg_view *view, struct wlr_surface *surface)
 	wl_signal_add(&view->foreign_toplevel_handle->events.request_close, &view->request_close);
 
 	seat_set_focus(view->server->seat, view);
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	histogram_add(&view->server->view_map_time, timespec_to_nsec(&end) - timespec_to_nsec(&start));
+
+	/* A replay starts once there is a client to send the events to. */
+	replay_begin(view->server->seat);
 	return;
 
 fail:
@@ -186,12 +388,15 @@ void
 view_destroy(struct cg_view *view)
 {
 	struct cg_server *server = view->server;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
 	if (view->wlr_surface != NULL) {
 		view_unmap(view);
 	}
 
 	view->impl->destroy(view);
+	server->views_destroyed++;
 
 	/* If there is a previous view in the list, focus that. */
 	bool empty = wl_list_empty(&server->views);
@@ -199,6 +404,10 @@ view_destroy(struct cg_view *view)
 		struct cg_view *prev = wl_container_of(server->views.next, prev, link);
 		seat_set_focus(server->seat, prev);
 	}
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	histogram_add(&server->view_destroy_time, timespec_to_nsec(&end) - timespec_to_nsec(&start));
 }
 
 void
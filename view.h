@@ -4,6 +4,7 @@
 #include "config.h"
 
 #include <stdbool.h>
+#include <sys/types.h>
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_compositor.h>
 #include <wlr/types/wlr_xdg_shell.h>
@@ -33,6 +34,16 @@ struct cg_view {
 	enum cg_view_type type;
 	const struct cg_view_impl *impl;
 
+	/* The application this view belongs to, if it is one Cage launched. */
+	struct cg_app *app;
+
+	/* The part of the layout the view's main surface covers opaquely,
+	 * empty if it is translucent anywhere. */
+	struct wlr_box opaque_box;
+	/* Hidden behind opaque views, see view_update_occlusion. */
+	bool occluded;
+	struct wl_listener commit;
+
 	struct wlr_foreign_toplevel_handle_v1 *foreign_toplevel_handle;
 	struct wl_listener request_activate;
 	struct wl_listener request_close;
@@ -43,6 +54,7 @@ struct cg_view_impl {
 	void (*get_geometry)(struct cg_view *view, int *width_out, int *height_out);
 	bool (*is_primary)(struct cg_view *view);
 	bool (*is_transient_for)(struct cg_view *child, struct cg_view *parent);
+	pid_t (*get_pid)(struct cg_view *view);
 	void (*activate)(struct cg_view *view, bool activate);
 	void (*maximize)(struct cg_view *view, int output_width, int output_height);
 	void (*close)(struct cg_view *view);
@@ -53,8 +65,10 @@ char *view_get_title(struct cg_view *view);
 bool view_is_primary(struct cg_view *view);
 bool view_is_transient_for(struct cg_view *child, struct cg_view *parent);
 void view_activate(struct cg_view *view, bool activate);
+void view_get_layout_box(struct cg_view *view, struct wlr_box *box);
 void view_position(struct cg_view *view);
 void view_position_all(struct cg_server *server);
+void view_schedule_occlusion_update(struct cg_server *server);
 void view_unmap(struct cg_view *view);
 void view_map(struct cg_view *view, struct wlr_surface *surface);
 void view_destroy(struct cg_view *view);
@@ -9,6 +9,7 @@
 #include <assert.h>
 #include <stdbool.h>
 #include <stdlib.h>
+#include <time.h>
 #include <wayland-server-core.h>
 #include <wlr/types/wlr_foreign_toplevel_management_v1.h>
 #include <wlr/types/wlr_scene.h>
@@ -16,6 +17,7 @@
 #include <wlr/util/log.h>
 
 #include "server.h"
+#include "stats.h"
 #include "view.h"
 #include "xdg_shell.h"
 
@@ -162,6 +164,17 @@ is_transient_for(struct cg_view *child, struct cg_view *parent)
 	return false;
 }
 
+static pid_t
+get_pid(struct cg_view *view)
+{
+	struct cg_xdg_shell_view *xdg_shell_view = xdg_shell_view_from_view(view);
+	struct wl_client *client = wl_resource_get_client(xdg_shell_view->xdg_toplevel->resource);
+
+	pid_t pid;
+	wl_client_get_credentials(client, &pid, NULL, NULL);
+	return pid;
+}
+
 static void
 activate(struct cg_view *view, bool activate)
 {
@@ -199,7 +212,7 @@ set_fullscreen(struct cg_xdg_shell_view *xdg_shell_view, bool fullscreen)
 	 * display in fullscreen mode, so we set it here.
 	 */
 	struct wlr_box layout_box;
-	wlr_output_layout_get_box(xdg_shell_view->view.server->output_layout, NULL, &layout_box);
+	view_get_layout_box(&xdg_shell_view->view, &layout_box);
 	wlr_xdg_toplevel_set_size(xdg_shell_view->xdg_toplevel, layout_box.width, layout_box.height);
 	wlr_xdg_toplevel_set_fullscreen(xdg_shell_view->xdg_toplevel, fullscreen);
 }
@@ -294,6 +307,7 @@ static const struct cg_view_impl xdg_shell_view_impl = {
 	.get_geometry = get_geometry,
 	.is_primary = is_primary,
 	.is_transient_for = is_transient_for,
+	.get_pid = get_pid,
 	.activate = activate,
 	.maximize = maximize,
 	.destroy = destroy,
@@ -357,12 +371,9 @@ popup_handle_reposition(struct wl_listener *listener, void *data)
 	popup_unconstrain(popup->xdg_popup);
 }
 
-void
-handle_new_xdg_popup(struct wl_listener *listener, void *data)
+static void
+popup_create(struct wlr_xdg_popup *wlr_popup)
 {
-	struct cg_server *server = wl_container_of(listener, server, new_xdg_popup);
-	struct wlr_xdg_popup *wlr_popup = data;
-
 	struct cg_view *view = popup_get_view(wlr_popup);
 	if (view == NULL) {
 		return;
@@ -414,11 +425,27 @@ handle_new_xdg_popup(struct wl_listener *listener, void *data)
 	wlr_popup->base->data = popup_scene_tree;
 }
 
+void
+handle_new_xdg_popup(struct wl_listener *listener, void *data)
+{
+	struct cg_server *server = wl_container_of(listener, server, new_xdg_popup);
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+
+	popup_create(data);
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	histogram_add(&server->popup_create_time, timespec_to_nsec(&end) - timespec_to_nsec(&start));
+}
+
 void
 handle_xdg_toplevel_decoration(struct wl_listener *listener, void *data)
 {
 	struct cg_server *server = wl_container_of(listener, server, xdg_toplevel_decoration);
 	struct wlr_xdg_toplevel_decoration_v1 *wlr_decoration = data;
+	struct timespec start;
+	clock_gettime(CLOCK_MONOTONIC, &start);
 
 	struct cg_xdg_decoration *xdg_decoration = calloc(1, sizeof(struct cg_xdg_decoration));
 	if (!xdg_decoration) {
@@ -434,4 +461,8 @@ handle_xdg_toplevel_decoration(struct wl_listener *listener, void *data)
 	wl_signal_add(&wlr_decoration->toplevel->base->surface->events.commit, &xdg_decoration->commit);
 	xdg_decoration->request_mode.notify = xdg_decoration_handle_request_mode;
 	wl_signal_add(&wlr_decoration->events.request_mode, &xdg_decoration->request_mode);
+
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	histogram_add(&server->decoration_create_time, timespec_to_nsec(&end) - timespec_to_nsec(&start));
 }
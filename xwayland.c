@@ -80,6 +80,13 @@ is_transient_for(struct cg_view *child, struct cg_view *parent)
 	return false;
 }
 
+static pid_t
+get_pid(struct cg_view *view)
+{
+	struct cg_xwayland_view *xwayland_view = xwayland_view_from_view(view);
+	return xwayland_view->xwayland_surface->pid;
+}
+
 static void
 activate(struct cg_view *view, bool activate)
 {
@@ -174,6 +181,7 @@ static const struct cg_view_impl xwayland_view_impl = {
 	.get_geometry = get_geometry,
 	.is_primary = is_primary,
 	.is_transient_for = is_transient_for,
+	.get_pid = get_pid,
 	.activate = activate,
 	.maximize = maximize,
 	.destroy = destroy,